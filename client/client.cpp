@@ -1,10 +1,15 @@
 #include <stdexcept>
 #include <cstring>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include "client.h"
 
-Member::Member(std::string remoteAddress, int remotePort, int srcId) : mRunning(true)
+Member::Member(std::string remoteAddress, int remotePort, int srcId, int wireVersion)
+    : mWireVersion(wireVersion), mRunning(true)
 {
     mId = srcId;
+    wireReset(mWire, 1);
     memset(&mRemoteAddr, 0, sizeof(mRemoteAddr));
     mRemoteAddr.sin_family = AF_INET;
     mRemoteAddr.sin_addr.s_addr = inet_addr(remoteAddress.c_str());
@@ -20,11 +25,31 @@ Member::Member(std::string remoteAddress, int remotePort, int srcId) : mRunning(
     mThread = make_unique_cpp11<std::thread>([&]() { run(); });
 }
 
+Member::Member(const std::string& unixPath, int srcId, bool sharedMemory, int wireVersion)
+    : mWireVersion(sharedMemory ? 1 : wireVersion), mRunning(true)
+{
+    mId = srcId;
+    wireReset(mWire, 1);
+    mSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (mSocket < 0)
+        throw std::runtime_error("socket() failed");
+
+    if (connectToServer(unixPath, sharedMemory) != 0)
+        throw std::runtime_error("connectToServer() failed");
+
+    mThread = make_unique_cpp11<std::thread>([&]() { run(); });
+}
+
 Member::~Member()
 {
     mRunning = false;
     mThread->join();
     close(mSocket);
+    if (mRegion != nullptr)
+        munmap(mRegion, sizeof(shm_region_t));
+    if (mOrder.gaps + mOrder.reordered > 0)
+        printf("Member(%d): %lu request(s) in order, %lu gap(s) (%lu missing), %lu reordered\n", mId, mOrder.inOrder,
+               mOrder.gaps, mOrder.missing, mOrder.reordered);
     printf("Member::~Member() called\n");
 }
 
@@ -33,22 +58,221 @@ int Member::connectToServer()
     if (connect(mSocket, (struct sockaddr*) &mRemoteAddr, sizeof(struct sockaddr_in)) != 0)
         return -1;
 
-    mMessage.setId(mId, 0);
-    return send(mSocket, mMessage.getData(), mMessage.getSize(), 0) == mMessage.getSize() ? 0 : -2;
+    return registerWithServer();
+}
+
+int Member::connectToServer(const std::string& unixPath, bool sharedMemory)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (unixPath.size() >= sizeof(addr.sun_path))
+        return -1;
+    strncpy(addr.sun_path, unixPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (connect(mSocket, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+        return -1;
+
+    if (sharedMemory)
+        return attachSharedMemory();
+
+    return registerWithServer();
+}
+
+/**
+ * Sends the registration frame, asking for the compact wire format if
+ * wanted. From the switch's acknowledgement on both sides use it.
+ */
+int Member::registerWithServer()
+{
+    Message registration;
+    registration.setId(mId, 0);
+    if (mWireVersion == 2)
+        registration.getMti() = ISC_MTI_WIRE_V2;
+
+    if (send(mSocket, registration.getData(), registration.getSize(), 0) != registration.getSize())
+        return -2;
+
+    if (mWireVersion == 2)
+    {
+        if (waitForAck(registration) != 0)
+            return -4; // the switch does not speak v2
+        wireReset(mWire, 2);
+    }
+    return 0;
+}
+
+/**
+ * Waits for the switch to echo request back as a reply.
+ */
+int Member::waitForAck(Message& request)
+{
+    Message ack;
+    struct timeval tv;
+    tv.tv_sec = TIMEOUT / 1000;
+    tv.tv_usec = (TIMEOUT % 1000) * 1000;
+    setsockopt(mSocket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    int rc = recv(mSocket, ack.getData(), ack.getSize(), MSG_WAITALL);
+
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    setsockopt(mSocket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    return rc == ack.getSize() && ack.getMti() == request.getMti() && ack.isReply() ? 0 : -1;
+}
+
+/**
+ * Registers with a memfd holding the rings attached and waits for the
+ * switch to echo the registration back.
+ */
+int Member::attachSharedMemory()
+{
+    int memFd = memfd_create("isc_member", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memFd < 0 || ftruncate(memFd, sizeof(shm_region_t)) != 0 ||
+        fcntl(memFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)
+    {
+        if (memFd > -1)
+            close(memFd);
+        return -3;
+    }
+
+    void* data = mmap(nullptr, sizeof(shm_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(memFd);
+        return -3;
+    }
+    mRegion = (shm_region_t*) data;
+    mRegion->magic = SHM_MAGIC;
+    mRegion->size = sizeof(shm_region_t);
+
+    Message attach;
+    attach.setId(mId, 0);
+    attach.getMti() = ISC_MTI_SHM_ATTACH;
+
+    struct iovec iov;
+    iov.iov_base = attach.getData();
+    iov.iov_len = attach.getSize();
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memFd, sizeof(int));
+
+    int rc = sendmsg(mSocket, &msg, 0);
+    close(memFd); // the mapping keeps the region alive
+    if (rc != attach.getSize())
+        return -2;
+
+    return waitForAck(attach) == 0 ? 0 : -4; // -4: the switch does not support shared memory
+}
+
+int Member::writeFrame(const uint8_t* data, int size)
+{
+    if (mRegion == nullptr && mWire.version == 2)
+    {
+        uint8_t encoded[WIRE_V2_MAX_FRAME];
+        size_t count = wireEncode(mWire, data, encoded);
+        return send(mSocket, encoded, count, 0) == (int) count ? size : -1;
+    }
+
+    if (mRegion == nullptr)
+        return send(mSocket, data, size, 0);
+
+    bool notify = false;
+    while (!ringWrite(&mRegion->up, data, size, notify))
+    {
+        if (!mRunning)
+            return -1;
+        std::this_thread::sleep_for(std::chrono::microseconds(50)); // the switch is behind
+    }
+
+    if (notify)
+    {
+        char doorbell = 0;
+        send(mSocket, &doorbell, sizeof(doorbell), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    return size;
 }
 
 int Member::sendMessage(int mti, int dst_id, bool is_reply)
 {
+    std::lock_guard<std::mutex> lock(mSendMutex); // the reply thread sends too
+
     mMessage.setId(mId, dst_id);
     if (mti >= 0)
         mMessage.getMti() = mti;
     mMessage.setReply(is_reply);
 
-    return send(mSocket, mMessage.getData(), mMessage.getSize(), 0);
+    // numbers the requests to each destination, the switch matches the reply by it
+    if (!is_reply)
+        setSequence(*(isc_msg_t*) mMessage.getData(), ++mSequences[dst_id]);
+
+    return writeFrame(mMessage.getData(), mMessage.getSize());
+}
+
+/**
+ * Answers request with MTI + 10, echoing its trace.
+ */
+int Member::sendReply(Message& request)
+{
+    std::lock_guard<std::mutex> lock(mSendMutex);
+
+    mMessage.setId(mId, request.getSrcId());
+    mMessage.getMti() = request.getMti() + 10;
+    mMessage.setReply(true);
+    memcpy(((isc_msg_t*) mMessage.getData())->trace + 1, ((isc_msg_t*) request.getData())->trace + 1, 5);
+
+    return writeFrame(mMessage.getData(), mMessage.getSize());
 }
 
 int Member::receiveMessage(Message& message, int timeout)
 {
+    if (mRegion != nullptr)
+    {
+        /**********************************************/
+        /* Doorbells first, then the ring; wait for   */
+        /* the next doorbell only if it is empty.     */
+        /**********************************************/
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            char doorbells[256];
+            int rc;
+            while ((rc = recv(mSocket, doorbells, sizeof(doorbells), MSG_DONTWAIT)) > 0)
+                ;
+            if (rc == 0 || (errno != EWOULDBLOCK && errno != EAGAIN))
+                return 0; // switch dropped the connection
+
+            bool notify = false;
+            if (ringRead(&mRegion->down, message.getData(), message.getSize(), notify) > 0)
+            {
+                if (notify) // the switch waits for room
+                {
+                    char doorbell = 0;
+                    send(mSocket, &doorbell, sizeof(doorbell), MSG_DONTWAIT | MSG_NOSIGNAL);
+                }
+                return message.getSize();
+            }
+
+            // wake up now and then so that the destructor can stop run()
+            struct pollfd pfd = {mSocket, POLLIN, 0};
+            if (attempt == 0 && poll(&pfd, 1, timeout >= 0 ? timeout : 100) <= 0)
+                break;
+        }
+        return -1;
+    }
+
     if (timeout >= 0)
     {
         struct timeval tv;
@@ -57,6 +281,9 @@ int Member::receiveMessage(Message& message, int timeout)
         setsockopt(mSocket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
     }
 
+    if (mWire.version == 2)
+        return receiveCompact(message);
+
     int res = recv(mSocket, message.getData(), message.getSize(), 0);
     if (res > 0)
     {
@@ -79,6 +306,34 @@ int Member::receiveMessage(Message& message, int timeout)
     }
 }
 
+/**
+ * Decodes the next v2 frame, reading the socket only when no whole frame
+ * is buffered.
+ */
+int Member::receiveCompact(Message& message)
+{
+    while (true)
+    {
+        int rc = wireDecode(mWire, (const uint8_t*) mInput.data(), mInput.size(), message.getData());
+        if (rc > 0)
+        {
+            mInput.erase(0, rc);
+            return message.getSize();
+        }
+        if (rc < 0)
+            return 0; // corrupted stream, claim the switch dropped it
+
+        char raw[1024];
+        int res = recv(mSocket, raw, sizeof(raw), 0);
+        if (res == 0)
+            return 0;
+        if (res < 0)
+            return errno == EWOULDBLOCK || errno == EAGAIN ? -1 : 0;
+
+        mInput.append(raw, res);
+    }
+}
+
 void Member::run()
 {
     std::lock_guard<std::mutex> lock(mMutex);
@@ -106,12 +361,25 @@ void Member::run()
 
         if (!message.isReply()) // is not reply
         {
-            printf("Request message: %u from member(%u)\n", message.getMti(), message.getSrcId());
-            sendMessage(message.getMti() + 10, message.getSrcId(), true);
+            const isc_msg_t& request = *(const isc_msg_t*) message.getData();
+            const char* order = "";
+            if (hasSequence(request))
+            {
+                seq_state_t& state = mReceived[message.getSrcId()];
+                uint64_t last = state.last;
+                int verdict = seqCheck(state, getSequence(request), mOrder);
+                if (verdict == SEQ_GAP)
+                    printf("Member(%d): %lu request(s) from member(%u) missing\n", mId,
+                           (unsigned long) (state.last - last - 1), message.getSrcId());
+                order = verdict == SEQ_REORDERED ? " (out of order)" : "";
+            }
+            printf("Request message: %u from member(%u)%s\n", message.getMti(), message.getSrcId(), order);
+            sendReply(message);
         }
         else
         {
-            printf("Reply message: %u from member(%u)\n", message.getMti(), message.getSrcId());
+            printf("Reply message: %u from member(%u)%s\n", message.getMti(), message.getSrcId(),
+                   message.isReply() == REPLY_TIMEOUT ? " (timed out)" : "");
         }
     }
 }
@@ -10,6 +10,7 @@
 #include <atomic>
 #include <vector>
 #include <deque>
+#include <unordered_map>
 #include <cstdlib>
 #include <cstdio>
 #include <sys/socket.h>
@@ -19,16 +20,36 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <isc_msg.h>
+#include <isc_seq.h>
+#include <isc_shm.h>
+#include <isc_codec.h>
 
 class Member
 {
   public:
-    Member(std::string ipAddress = "127.0.0.1", int port = BASE_PORT, int srcId = 0);
+    /**
+     * @param wireVersion 2 to negotiate the compact wire format
+     */
+    Member(std::string ipAddress = "127.0.0.1", int port = BASE_PORT, int srcId = 0, int wireVersion = 1);
+
+    /**
+     * Connects to the switch's Unix-domain socket (server -u) and, with
+     * sharedMemory, moves all traffic onto shared-memory rings. Rings
+     * always carry v1 frames.
+     */
+    Member(const std::string& unixPath, int srcId, bool sharedMemory, int wireVersion = 1);
     ~Member();
 
   private:
     int connectToServer();
+    int connectToServer(const std::string& unixPath, bool sharedMemory);
+    int registerWithServer();
+    int waitForAck(Message& request);
+    int attachSharedMemory();
+    int writeFrame(const uint8_t* data, int size);
+    int receiveCompact(Message& message);
     int receiveMessage(Message& message, int timeout = 5);
+    int sendReply(Message& request);
     void run();
 
   public:
@@ -45,14 +66,23 @@ class Member
 
   private:
     int mId;
+    int mWireVersion;
     Message mMessage;
+    std::unordered_map<int, uint64_t> mSequences; // dst --> last request sent, stamped in trace[1..5]
+
+    std::unordered_map<int, seq_state_t> mReceived; // src --> requests seen, by run() only
+    seq_counters_t mOrder{};
 
     std::unique_ptr<std::thread> mThread;
     std::mutex mMutex;
+    std::mutex mSendMutex;
     std::atomic_bool mRunning; // used to be able to terminate background threads
 
     int mSocket;
     struct sockaddr_in mRemoteAddr = {0};
+    shm_region_t* mRegion = nullptr; // null unless attached to shared memory
+    wire_state_t mWire{};              // v1 until the switch acknowledges v2
+    std::string mInput;                // v2 bytes not decoded yet
 };
 
 #endif // CLIENT_H
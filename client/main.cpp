@@ -13,6 +13,7 @@
 #include <iostream>
 #include <signal.h>
 #include "client.h"
+#include "member_pool.h"
 
 /** G L O B A L  V A R I A B L E S **********************************/
 std::atomic<bool> quit(false);
@@ -55,6 +56,35 @@ static bool getInputMsg(int& msg, int& dstId)
     return false;
 }
 
+static void onSignal(int)
+{
+    quit.store(true);
+}
+
+/**
+ * Runs count members from srcId on, multiplexed over a few threads, and
+ * prints their counters every second until SIGINT.
+ */
+static int runPool(const std::string& ipAddress, int port, int srcId, int count, int threads, int rate)
+{
+    MemberPool pool(ipAddress, port, srcId, count, threads);
+    if (pool.start(rate) < 0)
+        return 1;
+
+    printf("  MemberPool: members (%d..%d) connected on %d thread(s)\n", srcId, srcId + count - 1, threads);
+    signal(SIGINT, onSignal);
+
+    while (!quit.load())
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        pool.report(stdout);
+        fflush(stdout);
+    }
+
+    pool.stop();
+    return 0;
+}
+
 /*
  * main program entry
  */
@@ -65,9 +95,15 @@ int main(int argc, char* argv[])
     int srcId = 0;
     int dstId = 0;
     int msg = 0;
+    std::string unixPath;
+    bool sharedMemory = false;
+    int wireVersion = 1;
+    int poolSize = 0;
+    int poolThreads = 4;
+    int poolRate = 0;
     int opt;
 
-    while ((opt = getopt(argc, argv, ":a:p:s:h")) != -1)
+    while ((opt = getopt(argc, argv, ":a:p:u:mv:s:n:t:r:h")) != -1)
     {
         switch (opt)
         {
@@ -77,7 +113,13 @@ int main(int argc, char* argv[])
         case 'h':
             fprintf(stdout, "-a for server IP address\n"
                             "-p for server port number\n"
-                            "-s for source ID (from 1 to 999)\n");
+                            "-u for server Unix-domain socket path (server -u), instead of TCP\n"
+                            "-m to exchange messages through shared memory (needs -u)\n"
+                            "-v for wire format: 1 (default) or 2 (compact, not with -m)\n"
+                            "-s for source ID (from 1 to 999), first ID with -n\n"
+                            "-n for number of pooled members (e.g. -s 1 -n 999)\n"
+                            "-t for event loop threads of the pool (default 4)\n"
+                            "-r for requests per second generated by the pool (default 0)\n");
             exit(0);
         case ':':
             fprintf(stderr, "option needs a value\n");
@@ -88,15 +130,52 @@ int main(int argc, char* argv[])
         case 'p':
             port = atoi(optarg);
             break;
+        case 'u':
+            unixPath = optarg;
+            break;
+        case 'm':
+            sharedMemory = true;
+            break;
+        case 'v':
+            wireVersion = atoi(optarg);
+            break;
         case 's':
             srcId = atoi(optarg);
             break;
+        case 'n':
+            poolSize = atoi(optarg);
+            break;
+        case 't':
+            poolThreads = atoi(optarg);
+            break;
+        case 'r':
+            poolRate = atoi(optarg);
+            break;
         }
     }
 
-    Member member(ipAddress, port, srcId);
+    if (poolSize > 0)
+        return runPool(ipAddress, port, srcId > 0 ? srcId : 1, poolSize, poolThreads > 0 ? poolThreads : 1, poolRate);
+
+    if (sharedMemory && unixPath.empty())
+    {
+        fprintf(stderr, "-m needs the -u path of the server\n");
+        return 1;
+    }
+
+    if (wireVersion != 1 && (wireVersion != 2 || sharedMemory))
+    {
+        fprintf(stderr, "invalid wire format: %d\n", wireVersion);
+        return 1;
+    }
+
+    std::unique_ptr<Member> member;
+    if (unixPath.empty())
+        member = make_unique_cpp11<Member>(ipAddress, port, srcId, wireVersion);
+    else
+        member = make_unique_cpp11<Member>(unixPath, srcId, sharedMemory, wireVersion);
 
-    while (member.isRunning())
+    while (member->isRunning())
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
         if (quit.load())
@@ -104,7 +183,7 @@ int main(int argc, char* argv[])
 
         if (getInputMsg(msg, dstId))
         {
-            member.sendMessage(msg, dstId);
+            member->sendMessage(msg, dstId);
         }
     }
     return 0;
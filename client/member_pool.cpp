@@ -0,0 +1,344 @@
+#include <stdexcept>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "member_pool.h"
+
+#define POOL_EVENTS 256
+
+MemberPool::MemberPool(std::string remoteAddress, int remotePort, int firstId, int count, int threads)
+    : mFirstId(firstId), mCount(count), mRunning(false)
+{
+    memset(&mRemoteAddr, 0, sizeof(mRemoteAddr));
+    mRemoteAddr.sin_family = AF_INET;
+    mRemoteAddr.sin_addr.s_addr = inet_addr(remoteAddress.c_str());
+    mRemoteAddr.sin_port = htons(remotePort);
+
+    for (int i = 0; i < threads; i++)
+    {
+        mLoops.emplace_back(make_unique_cpp11<EventLoop>());
+        mLoops.back()->epoll = epoll_create1(0);
+        mLoops.back()->seed = 2654435761u * (i + 1);
+        if (mLoops.back()->epoll < 0)
+            throw std::runtime_error("epoll_create1() failed");
+    }
+}
+
+MemberPool::~MemberPool()
+{
+    stop();
+
+    for (auto& loop : mLoops)
+    {
+        for (auto& member : loop->members)
+        {
+            if (member.fd > -1)
+                close(member.fd);
+        }
+        close(loop->epoll);
+    }
+}
+
+int MemberPool::connectMember(int id)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr*) &mRemoteAddr, sizeof(mRemoteAddr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*) &on, sizeof(on));
+
+    Message registration;
+    registration.setId(id, 0);
+    if (send(fd, registration.getData(), registration.getSize(), 0) != registration.getSize())
+    {
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int MemberPool::start(int rate)
+{
+    /**********************************************/
+    /* One descriptor per member, raise the limit */
+    /* as far as we are allowed to.               */
+    /**********************************************/
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    for (int i = 0; i < mCount; i++)
+    {
+        int fd = connectMember(mFirstId + i);
+        if (fd < 0)
+        {
+            fprintf(stderr, "  MemberPool: member (%d) failed to connect: %s\n", mFirstId + i, strerror(errno));
+            return -1;
+        }
+
+        EventLoop& loop = *mLoops[i % mLoops.size()];
+        loop.members.push_back(PoolMember{mFirstId + i, fd, std::string(), std::string()});
+    }
+
+    // the vectors are final now, index them from epoll
+    for (auto& loop : mLoops)
+    {
+        for (size_t i = 0; i < loop->members.size(); i++)
+        {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = i;
+            epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->members[i].fd, &event);
+        }
+    }
+
+    mRate = rate;
+    mRunning = true;
+    for (auto& loop : mLoops)
+    {
+        EventLoop* ptr = loop.get();
+        loop->thread = make_unique_cpp11<std::thread>([this, ptr]() { loopHandler(*ptr); });
+    }
+    return mCount;
+}
+
+void MemberPool::stop()
+{
+    mRunning = false;
+    for (auto& loop : mLoops)
+    {
+        if (loop->thread != nullptr)
+        {
+            loop->thread->join();
+            loop->thread.reset();
+        }
+    }
+}
+
+void MemberPool::loopHandler(EventLoop& loop)
+{
+    using namespace std::chrono;
+
+    struct epoll_event events[POOL_EVENTS];
+    double loopRate = (double) mRate / mLoops.size();
+    auto start = steady_clock::now();
+    long generated = 0;
+    size_t next = 0;
+
+    while (mRunning)
+    {
+        int n = epoll_wait(loop.epoll, events, POOL_EVENTS, loopRate > 0 ? 1 : 100);
+        for (int i = 0; i < n; i++)
+        {
+            PoolMember& member = loop.members[events[i].data.u64];
+            if (events[i].events & EPOLLOUT)
+                flushMember(loop, member);
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                readMember(loop, member);
+        }
+
+        /**********************************************/
+        /* Keep the generated requests on schedule.   */
+        /**********************************************/
+        if (loopRate > 0)
+        {
+            double elapsed = duration_cast<duration<double>>(steady_clock::now() - start).count();
+            long due = (long) (elapsed * loopRate) - generated;
+            if (due > 0)
+            {
+                generate(loop, due, next);
+                generated += due;
+            }
+        }
+    }
+}
+
+void MemberPool::readMember(EventLoop& loop, PoolMember& member)
+{
+    char buffer[4096];
+
+    while (member.fd > -1)
+    {
+        int rc = recv(member.fd, buffer, sizeof(buffer), 0);
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (rc <= 0)
+        {
+            fprintf(stderr, "  MemberPool: member (%d) dropped by the switch\n", member.id);
+            epoll_ctl(loop.epoll, EPOLL_CTL_DEL, member.fd, nullptr);
+            close(member.fd);
+            member.fd = -1;
+            loop.dropped++;
+            break;
+        }
+
+        member.inBuffer.append(buffer, rc);
+    }
+
+    size_t offset = 0;
+    while (member.inBuffer.size() - offset >= sizeof(isc_msg_t))
+    {
+        Message message(member.inBuffer.data() + offset);
+        offset += sizeof(isc_msg_t);
+
+        if (message.getSrcId() == 0 || message.getDstId() != member.id) // drop message
+            continue;
+
+        if (!message.isReply())
+        {
+            const isc_msg_t& request = *(const isc_msg_t*) message.getData();
+            if (hasSequence(request))
+            {
+                int verdict = seqCheck(member.received[message.getSrcId()], getSequence(request), loop.order);
+                if (verdict == SEQ_GAP)
+                    loop.gaps++;
+                else if (verdict == SEQ_REORDERED)
+                    loop.reordered++;
+            }
+
+            message.setId(member.id, message.getSrcId());
+            message.getMti() += 10;
+            message.setReply(true);
+            sendFrame(loop, member, message);
+            loop.answered++;
+        }
+        else
+        {
+            if (message.isReply() == REPLY_TIMEOUT)
+                loop.timedOut++;
+            loop.replies++;
+        }
+    }
+    member.inBuffer.erase(0, offset);
+}
+
+void MemberPool::sendFrame(EventLoop& loop, PoolMember& member, Message& message)
+{
+    if (member.fd < 0)
+        return;
+
+    if (!member.outBuffer.empty())
+    {
+        member.outBuffer.append((const char*) message.getData(), message.getSize());
+        return; // keep the order, EPOLLOUT will flush it
+    }
+
+    int rc = send(member.fd, message.getData(), message.getSize(), MSG_NOSIGNAL);
+    if (rc == message.getSize())
+        return;
+    if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        return; // the read side notices the broken connection
+
+    rc = rc < 0 ? 0 : rc;
+    member.outBuffer.append((const char*) message.getData() + rc, message.getSize() - rc);
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.u64 = &member - loop.members.data();
+    epoll_ctl(loop.epoll, EPOLL_CTL_MOD, member.fd, &event);
+}
+
+void MemberPool::flushMember(EventLoop& loop, PoolMember& member)
+{
+    while (member.fd > -1 && !member.outBuffer.empty())
+    {
+        int rc = send(member.fd, member.outBuffer.data(), member.outBuffer.size(), MSG_NOSIGNAL);
+        if (rc <= 0)
+        {
+            if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            break;
+        }
+        member.outBuffer.erase(0, rc);
+    }
+
+    if (member.fd < 0)
+        return;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = &member - loop.members.data();
+    epoll_ctl(loop.epoll, EPOLL_CTL_MOD, member.fd, &event);
+}
+
+/**
+ * Sends count requests from this loop's members, taken in turn, to
+ * random members of the pool.
+ */
+void MemberPool::generate(EventLoop& loop, long count, size_t& next)
+{
+    if (loop.members.empty() || mCount < 2)
+        return;
+
+    Message message;
+    message.getMti() = POOL_REQUEST_MTI;
+
+    for (long i = 0; i < count; i++)
+    {
+        PoolMember& member = loop.members[next];
+        next = (next + 1) % loop.members.size();
+
+        // xorshift, cheap and good enough to spread the destinations
+        loop.seed ^= loop.seed << 13;
+        loop.seed ^= loop.seed >> 17;
+        loop.seed ^= loop.seed << 5;
+
+        int dstId = mFirstId + loop.seed % (mCount - 1);
+        if (dstId >= member.id)
+            dstId++; // never ourselves
+
+        setSequence(*(isc_msg_t*) message.getData(), ++member.sent[dstId]);
+
+        message.setId(member.id, dstId);
+        sendFrame(loop, member, message);
+        loop.requests++;
+    }
+}
+
+void MemberPool::report(FILE* file)
+{
+    long requests = 0, replies = 0, answered = 0, dropped = 0, timedOut = 0, gaps = 0, reordered = 0;
+    for (auto& loop : mLoops)
+    {
+        requests += loop->requests.load();
+        replies += loop->replies.load();
+        answered += loop->answered.load();
+        dropped += loop->dropped.load();
+        timedOut += loop->timedOut.load();
+        gaps += loop->gaps.load();
+        reordered += loop->reordered.load();
+    }
+
+    fprintf(file, "  MemberPool: %ld request(s) sent, %ld reply(s) received, %ld request(s) answered, %ld outstanding",
+            requests - mLastRequests, replies - mLastReplies, answered - mLastAnswered, requests - replies);
+    if (timedOut > 0)
+        fprintf(file, ", %ld timed out", timedOut);
+    if (dropped > 0)
+        fprintf(file, ", %ld member(s) dropped", dropped);
+    if (gaps + reordered > 0)
+        fprintf(file, ", %ld gap(s), %ld reordered", gaps, reordered);
+    fprintf(file, "\n");
+
+    mLastRequests = requests;
+    mLastReplies = replies;
+    mLastAnswered = answered;
+}
@@ -0,0 +1,95 @@
+#ifndef MEMBER_POOL_H
+#define MEMBER_POOL_H
+
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdio>
+#include <netinet/in.h>
+#include <isc_msg.h>
+#include <isc_seq.h>
+
+#define POOL_REQUEST_MTI 200 /* MTI of generated requests, answered with 210 */
+
+/**
+ * Many virtual members multiplexed over a few epoll threads.
+ *
+ * Members firstId .. firstId+count-1 each get their own registered
+ * connection, exactly like Member, and are spread round-robin over the
+ * event loops. A loop answers every request addressed to one of its
+ * members with MTI+10, and can generate requests between members of the
+ * pool at a fixed rate to soak-test the switch.
+ */
+class MemberPool
+{
+  public:
+    MemberPool(std::string ipAddress = "127.0.0.1", int port = BASE_PORT, int firstId = 1, int count = 999,
+               int threads = 4);
+    ~MemberPool();
+
+    /**
+     * Connects every member and starts the event loops.
+     * @param rate requests per second generated by the whole pool (0 = reply only)
+     * @return the number of members connected, or -1
+     */
+    int start(int rate);
+    void stop();
+
+    /**
+     * Prints the counters accumulated since the previous call.
+     */
+    void report(FILE* file);
+
+  private:
+    struct PoolMember
+    {
+        int id;
+        int fd;
+        std::string inBuffer;
+        std::string outBuffer; // frames the socket did not accept yet
+        std::unordered_map<int, uint64_t> sent{};         // dst --> last request, see Member::sendMessage()
+        std::unordered_map<int, seq_state_t> received{}; // src --> requests seen
+    };
+
+    struct EventLoop
+    {
+        int epoll = -1;
+        std::vector<PoolMember> members{};
+        std::unique_ptr<std::thread> thread;
+        uint32_t seed = 1;
+
+        std::atomic<long> requests{0}; // generated
+        std::atomic<long> replies{0};  // received for generated requests
+        std::atomic<long> answered{0}; // requests replied to
+        std::atomic<long> dropped{0};  // connections closed by the switch
+        std::atomic<long> timedOut{0}; // replies made up by the switch
+        std::atomic<long> gaps{0};      // requests of a pair skipped
+        std::atomic<long> reordered{0}; // requests of a pair out of order
+
+        seq_counters_t order{}; // of the loop's thread only
+    };
+
+    int connectMember(int id);
+    void loopHandler(EventLoop& loop);
+    void readMember(EventLoop& loop, PoolMember& member);
+    void sendFrame(EventLoop& loop, PoolMember& member, Message& message);
+    void flushMember(EventLoop& loop, PoolMember& member);
+    void generate(EventLoop& loop, long count, size_t& next);
+
+    struct sockaddr_in mRemoteAddr;
+    int mFirstId;
+    int mCount;
+    int mRate = 0;
+
+    std::vector<std::unique_ptr<EventLoop>> mLoops{};
+    std::atomic_bool mRunning;
+
+    long mLastRequests = 0;
+    long mLastReplies = 0;
+    long mLastAnswered = 0;
+};
+
+#endif // MEMBER_POOL_H
@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include "harness.h"
+
+Harness::Harness(uint32_t seed, int members) : mSeed(seed), mCount(members < 2 ? 2 : members)
+{
+    Message message;
+    memcpy(&mPattern, message.getData(), sizeof(mPattern));
+}
+
+/**
+ * xorshift, the whole script follows from the seed
+ */
+uint32_t Harness::next()
+{
+    mState ^= mState << 13;
+    mState ^= mState >> 17;
+    mState ^= mState << 5;
+    return mState;
+}
+
+/**
+ * Connects member over a new link and registers it, like Member does.
+ */
+void Harness::attach(Switch& sw, ScriptedMember& member)
+{
+    size_t writeLimit = member.link != nullptr ? member.link->writeLimit : 0;
+    member.link = std::make_shared<MemoryLink>();
+    member.link->writeLimit = writeLimit;
+
+    Message registration;
+    registration.setId(member.id, 0);
+    member.link->push(registration.getData(), registration.getSize());
+    sw.addConnection(make_unique_cpp11<MemoryConnection>(member.link));
+}
+
+/**
+ * Appends the next request of member to dstId to the burst.
+ */
+void Harness::appendRequest(ScriptedMember& member, int dstId)
+{
+    Message message;
+    message.getMti() = HARNESS_MTI;
+    message.setId(member.id, dstId);
+    setSequence(*(isc_msg_t*) message.getData(), ++member.sent[dstId - 1]);
+    mMembers[dstId - 1].expected++;
+    mBurst.append((const char*) message.getData(), message.getSize());
+}
+
+/**
+ * Pushes a burst of requests from member to random others, never to
+ * skipId, as one push or cut into several.
+ * @return the requests sent
+ */
+long Harness::sendBurst(ScriptedMember& member, const Scenario& scenario, int skipId)
+{
+    int count = 1 + next() % scenario.maxBurst;
+
+    mBurst.clear();
+    for (int i = 0; i < count; i++)
+    {
+        int dstId = 1 + next() % (mCount - 1);
+        if (dstId >= member.id)
+            dstId++; // never ourselves
+        if (dstId == skipId)
+            continue;
+        appendRequest(member, dstId);
+    }
+
+    if (!scenario.split)
+    {
+        member.link->push(mBurst.data(), mBurst.size());
+        return mBurst.size() / sizeof(isc_msg_t);
+    }
+
+    size_t offset = 0;
+    while (offset < mBurst.size())
+    {
+        size_t size = 1 + next() % (2 * sizeof(isc_msg_t));
+        size = std::min(size, mBurst.size() - offset);
+        member.link->push(mBurst.data() + offset, size);
+        offset += size;
+    }
+    return mBurst.size() / sizeof(isc_msg_t);
+}
+
+/**
+ * Pushes count requests from member to dstId as one push.
+ * @return the requests sent
+ */
+long Harness::sendTo(ScriptedMember& member, int dstId, int count)
+{
+    mBurst.clear();
+    for (int i = 0; i < count; i++)
+        appendRequest(member, dstId);
+
+    member.link->push(mBurst.data(), mBurst.size());
+    return count;
+}
+
+/**
+ * Checks the whole frames the switch wrote to member since last time.
+ * @return the frames taken
+ */
+long Harness::collect(ScriptedMember& member)
+{
+    std::string& output = member.link->output;
+    size_t size = output.size() - output.size() % sizeof(isc_msg_t);
+
+    for (size_t offset = 0; offset < size; offset += sizeof(isc_msg_t))
+    {
+        const isc_msg_t& frame = *(const isc_msg_t*) (output.data() + offset);
+        int srcId = frame.src_id[0] | (frame.src_id[1] << 8) | (frame.src_id[2] << 16);
+        int dstId = frame.dst_id[0] | (frame.dst_id[1] << 8) | (frame.dst_id[2] << 16);
+
+        if (dstId != member.id || srcId < 1 || srcId > mCount || frame.mti.val != HARNESS_MTI ||
+            frame.trace[0] != 0 || frame.packet_size != mPattern.packet_size ||
+            memcmp(frame.pan, mPattern.pan, sizeof(frame.pan)) != 0)
+        {
+            member.corrupt++;
+            continue;
+        }
+        seqCheck(member.received[srcId - 1], getSequence(frame), member.order);
+    }
+
+    output.erase(0, size);
+    member.link->newRound();
+    return size / sizeof(isc_msg_t);
+}
+
+bool Harness::run(const Scenario& scenario, long requests)
+{
+    if (scenario.flood && mCount < 4)
+    {
+        fprintf(stdout, "  Harness: %s: needs 4 members at least, skipped\n", scenario.name);
+        return true;
+    }
+
+    mState = mSeed;
+    mMembers.clear();
+    for (int i = 0; i < mCount; i++)
+    {
+        ScriptedMember member{i + 1, nullptr, std::vector<uint64_t>(mCount), std::vector<seq_state_t>(mCount),
+                              {0, 0, 0, 0}, 0, 0};
+        mMembers.push_back(std::move(member));
+    }
+
+    long sent = 0;
+    long received = 0;
+    long longestWait = 0; // rounds, of member 3's requests in a flood
+    size_t mostSlabs = 0; // of the frame pool
+    size_t mostLane = 0;  // frames held for one destination
+    auto start = std::chrono::steady_clock::now();
+    {
+        Switch sw(-1, mCount);
+        for (auto& member : mMembers)
+        {
+            attach(sw, member);
+            if (scenario.flood && member.id == 2)
+                member.link->roundLimit = scenario.writeLimit;
+            else if (scenario.writeLimit > 0 && !scenario.flood && member.id % 2 == 0)
+                member.link->writeLimit = scenario.writeLimit;
+        }
+
+        /**********************************************/
+        /* The last member hangs up after half of the */
+        /* requests and comes back after three        */
+        /* quarters; what was routed to it meanwhile  */
+        /* must wait for it.                          */
+        /**********************************************/
+        ScriptedMember& leaver = mMembers.back();
+        bool away = false;
+        bool back = false;
+
+        /**********************************************/
+        /* In a flood member 3 sends member 4 one     */
+        /* request a round meanwhile, which must not  */
+        /* wait behind the flood; nor may the flood   */
+        /* pile up in the switch.                     */
+        /**********************************************/
+        std::deque<long> probes{}; // rounds member 3's requests went out in
+        long round = 0;
+
+        int idle = 0;
+        while (idle < HARNESS_IDLE_ROUNDS)
+        {
+            round++;
+            int skipId = 0;
+            if (scenario.reconnect && !away && sent >= requests / 2)
+            {
+                leaver.link->close();
+                away = true;
+                skipId = leaver.id; // in flight when it hangs up, lost with its connection
+            }
+            else if (scenario.reconnect && away && !back && sent >= requests * 3 / 4)
+            {
+                attach(sw, leaver);
+                back = true;
+            }
+
+            if (scenario.flood && sent < requests)
+            {
+                sent += sendTo(mMembers[0], 2, scenario.maxBurst);
+                sent += sendTo(mMembers[2], 4, 1);
+                probes.push_back(round);
+            }
+
+            for (auto& member : mMembers)
+            {
+                if (sent >= requests || scenario.flood)
+                    break;
+                if (away && !back && &member == &leaver)
+                    continue;
+                sent += sendBurst(member, scenario, skipId);
+            }
+
+            if (!sw.step(0))
+                break;
+            mostSlabs = std::max(mostSlabs, sw.getSlabCount());
+            mostLane = std::max(mostLane, sw.getMaxLaneSize());
+
+            long taken = 0;
+            for (auto& member : mMembers)
+            {
+                long frames = collect(member);
+                for (long i = 0; scenario.flood && member.id == 4 && i < frames && !probes.empty(); i++)
+                {
+                    longestWait = std::max(longestWait, round - probes.front());
+                    probes.pop_front();
+                }
+                taken += frames;
+            }
+            received += taken;
+            idle = sent >= requests && taken == 0 ? idle + 1 : 0;
+            if (sent >= requests && received >= sent)
+                break;
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    /**********************************************/
+    /* Each member must have received everything  */
+    /* sent to it, intact and in order.           */
+    /**********************************************/
+    bool ok = received == sent;
+    for (auto& member : mMembers)
+    {
+        long got = member.order.inOrder + member.order.gaps + member.order.reordered;
+        if (got == member.expected && member.corrupt == 0 && member.order.gaps == 0 && member.order.reordered == 0)
+            continue;
+
+        fprintf(stdout, "  Harness: member (%d) received %ld of %ld request(s), %lu gap(s), %lu reordered, %ld corrupt\n",
+                member.id, got, member.expected, member.order.gaps, member.order.reordered, member.corrupt);
+        ok = false;
+    }
+
+    /**********************************************/
+    /* A flooded reader pauses its sender, so the */
+    /* lanes hold at most one batch past the cap, */
+    /* and leaves the others' rounds alone.       */
+    /**********************************************/
+    if (scenario.flood)
+    {
+        bool bounded = longestWait <= HARNESS_FLOOD_ROUNDS && mostSlabs <= FRAME_POOL_MAX_SLABS &&
+                       mostLane <= LANE_MAX_FRAMES + DECODE_BATCH_FRAMES;
+        fprintf(stdout, "  Harness: %s: quiet pair waited %ld round(s), %lu slab(s), %lu frame(s) for one member%s\n",
+                scenario.name, longestWait, mostSlabs, mostLane, bounded ? "" : ", over bounds");
+        ok = ok && bounded;
+    }
+
+    fprintf(stdout, "  Harness: %s: %ld of %ld request(s) routed in %.3f s (%.0f/s), %s\n", scenario.name, received,
+            sent, elapsed, received / elapsed, ok ? "ok" : "FAILED");
+    return ok;
+}
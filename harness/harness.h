@@ -0,0 +1,76 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include "isc_msg.h"
+#include "isc_seq.h"
+#include "server.h"
+#include "decoder.h"
+#include "memconnection.h"
+
+#define HARNESS_MTI 200        /* MTI of the scripted requests */
+#define HARNESS_IDLE_ROUNDS 64 /* rounds without output before giving up on the rest */
+#define HARNESS_FLOOD_ROUNDS 2 /* rounds a quiet pair's request may take during a flood */
+
+/**
+ * Drives a Switch in-process, on one thread and without network: members
+ * are MemoryConnections scripted from a seed, and Switch::step() runs the
+ * routing loop between their moves, so the same seed always routes the
+ * same frames in the same rounds.
+ *
+ * Every member sends bursts of numbered requests to random others and
+ * checks what it receives: each request intact, exactly once and in the
+ * order its sender numbered it.
+ */
+class Harness
+{
+  public:
+    struct Scenario
+    {
+        const char* name;
+        int maxBurst;      // requests a member pushes per round, at most
+        bool split;        // cut pushes at random bytes, mid-frame too
+        size_t writeLimit; // bytes half of the members take per write, 0 for all; in a flood, member 2 per round
+        bool reconnect;    // one member hangs up halfway and comes back later
+        bool flood;        // member 1 pushes maxBurst a round to member 2, the only slow reader
+    };
+
+    Harness(uint32_t seed = 1, int members = 16);
+
+    /**
+     * Routes requests through a new Switch as scenario says.
+     * @return true if every member received what was sent to it
+     */
+    bool run(const Scenario& scenario, long requests);
+
+  private:
+    struct ScriptedMember
+    {
+        int id;
+        std::shared_ptr<MemoryLink> link;
+        std::vector<uint64_t> sent;        // by destination id - 1, last sequence
+        std::vector<seq_state_t> received; // by source id - 1
+        seq_counters_t order;
+        long expected; // requests addressed to it
+        long corrupt;  // frames not as sent
+    };
+
+    uint32_t next();
+    void attach(Switch& sw, ScriptedMember& member);
+    void appendRequest(ScriptedMember& member, int dstId);
+    long sendBurst(ScriptedMember& member, const Scenario& scenario, int skipId);
+    long sendTo(ScriptedMember& member, int dstId, int count);
+    long collect(ScriptedMember& member);
+
+    uint32_t mSeed;
+    uint32_t mState = 0;
+    int mCount;
+    std::vector<ScriptedMember> mMembers{};
+    std::string mBurst{};
+    isc_msg_t mPattern; // fields a request keeps from Message()
+};
+
+#endif // HARNESS_H
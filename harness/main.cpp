@@ -0,0 +1,75 @@
+/**
+ * ISC Challenge project.
+ *
+ * Routes scripted traffic through an in-process Switch, without network,
+ * and checks that every member receives what was sent to it, intact and
+ * in order. Exits with 1 if a scenario fails.
+ */
+#include <unistd.h>
+#include <cstring>
+#include "harness.h"
+
+static const Harness::Scenario scenarios[] = {
+    {"coalesced", 64, false, 0, false, false},     // many frames per read
+    {"split", 8, true, 0, false, false},           // frames cut across reads
+    {"slow readers", 16, false, 50, false, false}, // short writes
+    {"reconnect", 8, true, 0, true, false},        // a member away for a while
+    {"flood", 512, false, 1000, false, true},      // one reader far behind its sender
+};
+
+/*
+ * main program entry
+ */
+int main(int argc, char* argv[])
+{
+    uint32_t seed = 1;
+    int members = 16;
+    long requests = 1000000;
+    std::string only;
+    int opt;
+
+    while ((opt = getopt(argc, argv, ":s:m:n:x:h")) != -1)
+    {
+        switch (opt)
+        {
+        default:
+        case '?':
+            fprintf(stderr, "unknown option: %c\n", optopt);
+        case 'h':
+            fprintf(stdout, "-s for the seed of the script (default 1)\n"
+                            "-m for number of members (default 16)\n"
+                            "-n for requests per scenario (default 1000000)\n"
+                            "-x for one scenario only: coalesced, split, slow readers, reconnect or flood\n");
+            exit(0);
+        case ':':
+            fprintf(stderr, "option needs a value\n");
+            exit(0);
+        case 's':
+            seed = strtoul(optarg, nullptr, 10);
+            break;
+        case 'm':
+            members = atoi(optarg);
+            break;
+        case 'n':
+            requests = atol(optarg);
+            break;
+        case 'x':
+            only = optarg;
+            break;
+        }
+    }
+
+    if (seed == 0)
+        seed = 1; // xorshift would stay at 0
+
+    Harness harness(seed, members);
+    int failed = 0;
+    for (const auto& scenario : scenarios)
+    {
+        if (!only.empty() && only != scenario.name)
+            continue;
+        if (!harness.run(scenario, requests))
+            failed++;
+    }
+    return failed > 0 ? 1 : 0;
+}
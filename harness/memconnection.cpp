@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "memconnection.h"
+
+static void ring(int fd)
+{
+    uint64_t one = 1;
+    if (fd > -1 && write(fd, &one, sizeof(one)) < 0)
+        perror("  eventfd write() failed");
+}
+
+void MemoryLink::push(const void* data, size_t size)
+{
+    input.emplace_back((const char*) data, size);
+    ring(fd);
+}
+
+void MemoryLink::close()
+{
+    closed = true;
+    ring(fd);
+}
+
+MemoryConnection::MemoryConnection(std::shared_ptr<MemoryLink> link)
+    : Connection(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), mLink(std::move(link))
+{
+    mLink->fd = mFd;
+    if (!mLink->input.empty() || mLink->closed)
+        ring(mFd);
+}
+
+MemoryConnection::~MemoryConnection()
+{
+    mLink->fd = -1; // the switch closes it
+}
+
+int MemoryConnection::receive(char* buffer, size_t size)
+{
+    if (mLink->input.empty())
+    {
+        if (mLink->closed)
+            return 0;
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    const std::string& front = mLink->input.front();
+    size_t count = std::min(size, front.size() - mLink->taken);
+    memcpy(buffer, front.data() + mLink->taken, count);
+    mLink->taken += count;
+    if (mLink->taken == front.size())
+    {
+        mLink->input.pop_front();
+        mLink->taken = 0;
+    }
+
+    // not readable any more until the next push, unless hung up
+    uint64_t value;
+    if (mLink->input.empty() && !mLink->closed && read(mFd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        perror("  eventfd read() failed");
+    return count;
+}
+
+int MemoryConnection::send(const void* data, size_t size)
+{
+    if (mLink->closed)
+    {
+        errno = EPIPE;
+        return -1;
+    }
+
+    mLink->output.append((const char*) data, size);
+    return size;
+}
+
+/**
+ * Takes writeLimit bytes at most, like a socket whose reader is behind,
+ * and none once roundLimit bytes were taken this round.
+ */
+int MemoryConnection::sendv(const struct iovec* iov, int count)
+{
+    if (mLink->closed)
+    {
+        errno = EPIPE;
+        return -1;
+    }
+
+    size_t limit = mLink->writeLimit > 0 ? mLink->writeLimit : SIZE_MAX;
+    if (mLink->roundLimit > 0)
+    {
+        if (mLink->roundTaken >= mLink->roundLimit)
+        {
+            errno = EWOULDBLOCK;
+            return -1;
+        }
+        limit = std::min(limit, mLink->roundLimit - mLink->roundTaken);
+    }
+
+    size_t sent = 0;
+    for (int i = 0; i < count && sent < limit; i++)
+    {
+        size_t size = std::min(iov[i].iov_len, limit - sent);
+        mLink->output.append((const char*) iov[i].iov_base, size);
+        sent += size;
+    }
+    mLink->roundTaken += sent;
+    return sent;
+}
@@ -0,0 +1,53 @@
+#ifndef MEMCONNECTION_H
+#define MEMCONNECTION_H
+
+#include <deque>
+#include <memory>
+#include <string>
+#include "connection.h"
+
+/**
+ * Member side of a MemoryConnection, scripted by a harness. Each push()
+ * is received on its own, so frames can be split or coalesced at will,
+ * and what the switch sends piles up in output.
+ */
+struct MemoryLink
+{
+    std::deque<std::string> input{}; // pushed, not received yet
+    size_t taken = 0;                // of input.front()
+    std::string output{};
+    size_t writeLimit = 0; // bytes taken per sendv(), 0 for all; a slow reader
+    size_t roundLimit = 0; // bytes taken until newRound(), 0 for all; a reader far behind
+    size_t roundTaken = 0;
+    bool closed = false;   // hung up, seen once input is received
+    int fd = -1;           // of the connection, -1 once the switch let it go
+
+    void push(const void* data, size_t size);
+    void close();
+    void newRound()
+    {
+        roundTaken = 0;
+    }
+};
+
+/**
+ * In-process transport for driving a Switch without network, see
+ * Switch::step(). Its descriptor is an eventfd that polls readable while
+ * the link has input. Not thread-safe, link and switch must be used from
+ * one thread.
+ */
+class MemoryConnection : public Connection
+{
+  public:
+    explicit MemoryConnection(std::shared_ptr<MemoryLink> link);
+    ~MemoryConnection() override;
+
+    int receive(char* buffer, size_t size) override;
+    int send(const void* data, size_t size) override;
+    int sendv(const struct iovec* iov, int count) override;
+
+  private:
+    std::shared_ptr<MemoryLink> mLink;
+};
+
+#endif // MEMCONNECTION_H
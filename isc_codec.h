@@ -0,0 +1,202 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <cstdint>
+#include <cstring>
+#include "isc_msg.h"
+
+/*
+ * Compact wire format (v2), negotiated per connection.
+ *
+ * A member asks for it with a registration frame of MTI ISC_MTI_WIRE_V2;
+ * once the switch echoes that frame back, both directions use v2. Each
+ * frame is a varint length followed by a field mask and only the fields
+ * that differ from the previous frame in the same direction:
+ *   mti, src_id, dst_id  zigzag varint of the difference
+ *   trace[0]             1 byte (the reply flag)
+ *   trace[1..5]          5 bytes
+ *   pan                  16 bytes
+ * Both sides start from the frame of a default Message, so an ordinary
+ * frame shrinks from 36 bytes to 3-6.
+ */
+#define ISC_MTI_WIRE_V2 0xFFFFFF05 /* src_id = member id, asks for v2 */
+
+#define WIRE_MTI 0x01
+#define WIRE_SRC 0x02
+#define WIRE_DST 0x04
+#define WIRE_REPLY 0x08
+#define WIRE_TRACE 0x10
+#define WIRE_PAN 0x20
+
+#define WIRE_V2_MAX_FRAME 37 /* length, mask and every field changed */
+
+typedef struct
+{
+    uint32_t version;  // 1 = fixed 36-byte frames, 2 = compact
+    uint32_t tailSize; // bytes of a v2 frame a full socket cut short, kept in tail
+    isc_msg_t txPrev;  // last frame encoded
+    isc_msg_t rxPrev;  // last frame decoded
+    uint8_t tail[WIRE_V2_MAX_FRAME];
+} wire_state_t;
+
+inline void wireReset(wire_state_t& state, int version)
+{
+    Message baseline;
+    memset(&state, 0, sizeof(state));
+    state.version = version;
+    memcpy(&state.txPrev, baseline.getData(), sizeof(isc_msg_t));
+    memcpy(&state.rxPrev, baseline.getData(), sizeof(isc_msg_t));
+}
+
+inline uint8_t* putVarint(uint8_t* out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t) value;
+    return out;
+}
+
+/**
+ * @return the byte after the varint, or nullptr if it runs past end
+ */
+inline const uint8_t* getVarint(const uint8_t* in, const uint8_t* end, uint32_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35 && in < end; shift += 7)
+    {
+        value |= (uint32_t) (*in & 0x7f) << shift;
+        if ((*in++ & 0x80) == 0)
+            return in;
+    }
+    return nullptr;
+}
+
+inline uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+inline int32_t unzigzag(uint32_t value)
+{
+    return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+inline uint32_t wireId(const uint8_t* id)
+{
+    return id[0] | (id[1] << 8) | (id[2] << 16);
+}
+
+inline void setWireId(uint8_t* id, uint32_t value)
+{
+    id[0] = value & 0xff;
+    id[1] = (value >> 8) & 0xff;
+    id[2] = (value >> 16) & 0xff;
+}
+
+/**
+ * Encodes one 36-byte frame into out, which needs WIRE_V2_MAX_FRAME bytes.
+ * @return the encoded size
+ */
+inline size_t wireEncode(wire_state_t& state, const uint8_t* data, uint8_t* out)
+{
+    isc_msg_t frame;
+    memcpy(&frame, data, sizeof(frame));
+    const isc_msg_t& prev = state.txPrev;
+
+    uint8_t body[WIRE_V2_MAX_FRAME];
+    uint8_t* ptr = body + 1;
+    uint8_t mask = 0;
+
+    if (frame.mti.val != prev.mti.val)
+    {
+        mask |= WIRE_MTI;
+        ptr = putVarint(ptr, zigzag((int32_t) (frame.mti.val - prev.mti.val)));
+    }
+    if (memcmp(frame.src_id, prev.src_id, 3) != 0)
+    {
+        mask |= WIRE_SRC;
+        ptr = putVarint(ptr, zigzag((int32_t) (wireId(frame.src_id) - wireId(prev.src_id))));
+    }
+    if (memcmp(frame.dst_id, prev.dst_id, 3) != 0)
+    {
+        mask |= WIRE_DST;
+        ptr = putVarint(ptr, zigzag((int32_t) (wireId(frame.dst_id) - wireId(prev.dst_id))));
+    }
+    if (frame.trace[0] != prev.trace[0])
+    {
+        mask |= WIRE_REPLY;
+        *ptr++ = frame.trace[0];
+    }
+    if (memcmp(frame.trace + 1, prev.trace + 1, 5) != 0)
+    {
+        mask |= WIRE_TRACE;
+        memcpy(ptr, frame.trace + 1, 5);
+        ptr += 5;
+    }
+    if (memcmp(frame.pan, prev.pan, sizeof(frame.pan)) != 0)
+    {
+        mask |= WIRE_PAN;
+        memcpy(ptr, frame.pan, sizeof(frame.pan));
+        ptr += sizeof(frame.pan);
+    }
+    body[0] = mask;
+
+    uint8_t* end = putVarint(out, ptr - body);
+    memcpy(end, body, ptr - body);
+    state.txPrev = frame;
+    return end - out + (ptr - body);
+}
+
+/**
+ * Decodes the first frame of data into a 36-byte frame.
+ * @return the bytes consumed, 0 if the frame is incomplete, -1 if malformed
+ */
+inline int wireDecode(wire_state_t& state, const uint8_t* data, size_t size, uint8_t* out)
+{
+    uint32_t length;
+    const uint8_t* ptr = getVarint(data, data + size, length);
+    if (ptr == nullptr)
+        return size < 5 ? 0 : -1;
+    if (length == 0 || length > WIRE_V2_MAX_FRAME - 1)
+        return -1;
+    if ((size_t) (ptr - data) + length > size)
+        return 0;
+
+    const uint8_t* end = ptr + length;
+    isc_msg_t frame = state.rxPrev;
+    uint8_t mask = *ptr++;
+    uint32_t value;
+
+    if ((mask & WIRE_MTI) && (ptr = getVarint(ptr, end, value)) != nullptr)
+        frame.mti.val += (uint32_t) unzigzag(value);
+    if (ptr != nullptr && (mask & WIRE_SRC) && (ptr = getVarint(ptr, end, value)) != nullptr)
+        setWireId(frame.src_id, wireId(frame.src_id) + unzigzag(value));
+    if (ptr != nullptr && (mask & WIRE_DST) && (ptr = getVarint(ptr, end, value)) != nullptr)
+        setWireId(frame.dst_id, wireId(frame.dst_id) + unzigzag(value));
+    if (ptr == nullptr)
+        return -1;
+
+    size_t fixed = ((mask & WIRE_REPLY) ? 1 : 0) + ((mask & WIRE_TRACE) ? 5 : 0) + ((mask & WIRE_PAN) ? 16 : 0);
+    if ((size_t) (end - ptr) != fixed)
+        return -1;
+
+    if (mask & WIRE_REPLY)
+        frame.trace[0] = *ptr++;
+    if (mask & WIRE_TRACE)
+    {
+        memcpy(frame.trace + 1, ptr, 5);
+        ptr += 5;
+    }
+    if (mask & WIRE_PAN)
+        memcpy(frame.pan, ptr, sizeof(frame.pan));
+
+    frame.packet_size = sizeof(isc_msg_t) - sizeof(frame.packet_size);
+    state.rxPrev = frame;
+    memcpy(out, &frame, sizeof(frame));
+    return end - data;
+}
+
+#endif // CODEC_H
@@ -0,0 +1,58 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "isc_msg.h"
+
+/*
+ * Binary journal of routed messages, written by the Logger (-j) and read
+ * by isc_challenge_replay. The file starts with JOURNAL_MAGIC followed by
+ * back-to-back journal_record_t.
+ */
+#define JOURNAL_MAGIC "ISCJRNL1"
+#define JOURNAL_MAGIC_SIZE 8
+
+typedef struct
+{
+    uint64_t timestamp; // microseconds since epoch, taken when the Switch routed the frame
+    isc_msg_t frame;
+    uint32_t reserved;
+} journal_record_t;
+
+inline uint64_t journalClock()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+inline void fillRecord(journal_record_t& record, const isc_msg_t& frame, uint64_t timestamp = journalClock())
+{
+    record.timestamp = timestamp;
+    memcpy(&record.frame, &frame, sizeof(record.frame));
+    record.reserved = 0;
+}
+
+/**
+ * Opens a journal for appending, writing the magic to a new file. The
+ * magic is flushed, so a fork() does not write it twice.
+ * @return nullptr on failure
+ */
+inline FILE* openJournal(const char* path)
+{
+    FILE* file = fopen(path, "ab");
+    if (file == nullptr)
+        return nullptr;
+
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0 && (fwrite(JOURNAL_MAGIC, 1, JOURNAL_MAGIC_SIZE, file) != JOURNAL_MAGIC_SIZE || fflush(file) != 0))
+    {
+        fclose(file);
+        return nullptr;
+    }
+    return file;
+}
+
+#endif // JOURNAL_H
@@ -11,6 +11,7 @@
 
 #define BASE_PORT 49153
 #define TIMEOUT 1000 /* milliseconds */
+#define REPLY_TIMEOUT 2 /* reply flag of the answer the switch makes up when a request timed out */
 #define FILENAME "messages.msg"
 
 // structure for message queue
@@ -47,6 +48,7 @@ class Message
     Message()
     {
         data.packet_size = sizeof(isc_msg_t) - sizeof(data.packet_size);
+        data.mti.val = 0;
         setId(0, 0);
 
         for (int i = 0; i < 6; i++)
@@ -0,0 +1,83 @@
+#ifndef SEQ_H
+#define SEQ_H
+
+#include <cstdint>
+#include <cstring>
+#include "isc_msg.h"
+
+/*
+ * Per-pair request sequences.
+ *
+ * A member numbers the requests it sends to each destination 1, 2, 3...
+ * in trace[1..5], big endian, and a reply echoes the number of its
+ * request. A frame still carrying the default trace of Message has no
+ * number. Whoever sees the requests of a (src, dst) pair in the order
+ * they were sent sees their numbers go up one at a time: a jump ahead is
+ * a gap, a number at or below one seen before is a reordering (or a
+ * repeat).
+ */
+#define SEQ_IN_ORDER 0
+#define SEQ_GAP 1
+#define SEQ_REORDERED 2
+
+typedef struct
+{
+    uint64_t last; // highest sequence seen, 0 before the first
+} seq_state_t;
+
+typedef struct
+{
+    uint64_t inOrder;   // one above the previous
+    uint64_t gaps;      // jumps ahead
+    uint64_t missing;   // sequences skipped by the jumps
+    uint64_t reordered; // at or below one seen before
+} seq_counters_t;
+
+inline uint64_t getSequence(const isc_msg_t& frame)
+{
+    uint64_t sequence = 0;
+    for (int i = 1; i < 6; i++)
+        sequence = sequence << 8 | frame.trace[i];
+    return sequence;
+}
+
+inline void setSequence(isc_msg_t& frame, uint64_t sequence)
+{
+    for (int i = 5; i > 0; i--, sequence >>= 8)
+        frame.trace[i] = sequence & 0xff;
+}
+
+inline bool hasSequence(const isc_msg_t& frame)
+{
+    static const uint8_t unstamped[] = {2, 3, 4, 5, 6}; // what Message() puts there
+    return memcmp(frame.trace + 1, unstamped, sizeof(unstamped)) != 0;
+}
+
+/**
+ * Accounts the next sequence of a pair, in the order it is seen. The
+ * first one seen is taken as it is, the sender may have started before
+ * the observer.
+ * @return SEQ_IN_ORDER, SEQ_GAP or SEQ_REORDERED
+ */
+inline int seqCheck(seq_state_t& state, uint64_t sequence, seq_counters_t& counters)
+{
+    if (state.last == 0 || sequence == state.last + 1)
+    {
+        state.last = sequence;
+        counters.inOrder++;
+        return SEQ_IN_ORDER;
+    }
+
+    if (sequence <= state.last)
+    {
+        counters.reordered++;
+        return SEQ_REORDERED;
+    }
+
+    counters.gaps++;
+    counters.missing += sequence - state.last - 1;
+    state.last = sequence;
+    return SEQ_GAP;
+}
+
+#endif // SEQ_H
@@ -0,0 +1,132 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include "isc_msg.h"
+
+/*
+ * Shared-memory transport for members on the same host as the switch.
+ *
+ * The member creates a memfd holding two single-producer/single-consumer
+ * rings and passes it over the switch's Unix-domain socket with its
+ * registration frame (MTI ISC_MTI_SHM_ATTACH). The switch echoes the frame
+ * back once it has mapped the region; frames then travel through the rings
+ * and the socket only carries one-byte doorbells, sent when the reader may
+ * have found its ring empty or the writer found it full. A closed socket
+ * still means a gone member. The memfd is sealed against shrinking, so
+ * that neither side can lose the pages under the other.
+ */
+#define ISC_MTI_SHM_ATTACH 0xFFFFFF04 /* src_id = member id, memfd attached */
+#define SHM_MAGIC 0x15C05A11
+#define SHM_RING_FRAMES 4096
+#define SHM_RING_SIZE (SHM_RING_FRAMES * sizeof(isc_msg_t))
+
+typedef struct
+{
+    alignas(64) std::atomic<uint64_t> head; // bytes written, owned by the producer
+    alignas(64) std::atomic<uint64_t> tail; // bytes read, owned by the consumer
+    alignas(64) std::atomic<uint32_t> waiting; // the producer wants a doorbell once there is room
+    alignas(64) uint8_t data[SHM_RING_SIZE];
+} shm_ring_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t size;
+    shm_ring_t up;   // member --> switch
+    shm_ring_t down; // switch --> member
+} shm_region_t;
+
+/**
+ * Appends size bytes, all or nothing.
+ * @param notify set when the consumer may be waiting for a doorbell
+ * @return false if the ring has no room
+ */
+inline bool ringWrite(shm_ring_t* ring, const void* data, size_t size, bool& notify)
+{
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    if (SHM_RING_SIZE - (head - tail) < size)
+        return false;
+
+    size_t offset = head % SHM_RING_SIZE;
+    size_t first = size < SHM_RING_SIZE - offset ? size : SHM_RING_SIZE - offset;
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, (const uint8_t*) data + first, size - first);
+
+    // the consumer stores tail before it looks at head, so one of us sees the other
+    ring->head.store(head + size, std::memory_order_seq_cst);
+    notify = ring->tail.load(std::memory_order_seq_cst) == head;
+    return true;
+}
+
+/**
+ * Appends as many whole frames of size bytes as there is room for. When
+ * some are left the consumer is asked for a doorbell once it made room.
+ * @param notify set when the consumer may be waiting for a doorbell
+ * @return the number of bytes written
+ */
+inline size_t ringWriteSome(shm_ring_t* ring, const void* data, size_t size, bool& notify)
+{
+    size_t written = 0;
+    notify = false;
+    while (true)
+    {
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        size_t count = size - written < SHM_RING_SIZE - (head - tail) ? size - written : SHM_RING_SIZE - (head - tail);
+        count -= count % sizeof(isc_msg_t);
+
+        if (count > 0)
+        {
+            size_t offset = head % SHM_RING_SIZE;
+            size_t first = count < SHM_RING_SIZE - offset ? count : SHM_RING_SIZE - offset;
+            memcpy(ring->data + offset, (const uint8_t*) data + written, first);
+            memcpy(ring->data, (const uint8_t*) data + written + first, count - first);
+
+            ring->head.store(head + count, std::memory_order_seq_cst);
+            notify = notify || ring->tail.load(std::memory_order_seq_cst) == head;
+            written += count;
+        }
+        if (written == size)
+            return written;
+
+        // the consumer stores tail before it looks at waiting, so it rings or we see the room
+        ring->waiting.store(1, std::memory_order_seq_cst);
+        head = ring->head.load(std::memory_order_relaxed);
+        if (SHM_RING_SIZE - (head - ring->tail.load(std::memory_order_seq_cst)) < sizeof(isc_msg_t))
+            return written;
+    }
+}
+
+/**
+ * Takes up to size bytes of whole frames.
+ * @param notify set when the producer waits for a doorbell and the ring
+ *               is half empty, so that it does not trickle frame by frame
+ * @return the number of bytes read, 0 if the ring is empty
+ */
+inline size_t ringRead(shm_ring_t* ring, void* buffer, size_t size, bool& notify)
+{
+    notify = false;
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_seq_cst);
+
+    size_t count = head - tail < size ? head - tail : size;
+    count -= count % sizeof(isc_msg_t);
+    if (count == 0)
+        return 0;
+
+    size_t offset = tail % SHM_RING_SIZE;
+    size_t first = count < SHM_RING_SIZE - offset ? count : SHM_RING_SIZE - offset;
+    memcpy(buffer, ring->data + offset, first);
+    memcpy((uint8_t*) buffer + first, ring->data, count - first);
+
+    ring->tail.store(tail + count, std::memory_order_seq_cst);
+    notify = head - (tail + count) <= SHM_RING_SIZE / 2 && ring->waiting.load(std::memory_order_seq_cst) != 0 &&
+             ring->waiting.exchange(0) != 0;
+    return count;
+}
+
+#endif // SHM_H
@@ -0,0 +1,74 @@
+/**
+ * ISC Challenge project.
+ *
+ * Replays a recorded message journal against a running
+ * isc_challenge_server and reports routing throughput and latency.
+ */
+#include <unistd.h>
+#include "replay.h"
+
+/*
+ * main program entry
+ */
+int main(int argc, char* argv[])
+{
+    std::string ipAddress = "127.0.0.1";
+    std::string path;
+    int port = BASE_PORT;
+    double speed = 1.0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, ":a:p:f:x:h")) != -1)
+    {
+        switch (opt)
+        {
+        default:
+        case '?':
+            fprintf(stderr, "unknown option: %c\n", optopt);
+        case 'h':
+            fprintf(stdout, "-a for server IP address\n"
+                            "-p for server port number\n"
+                            "-f for recording: journal (server -j), raw frames or Logger output\n"
+                            "-x for speed: 1 for real time (default), N for N times faster, 0 for max\n");
+            exit(0);
+        case ':':
+            fprintf(stderr, "option needs a value\n");
+            exit(0);
+        case 'a':
+            ipAddress = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 'x':
+            speed = atof(optarg);
+            break;
+        }
+    }
+
+    if (path.empty())
+    {
+        fprintf(stderr, "-f is required\n");
+        return 1;
+    }
+
+    Replay replay(ipAddress, port, speed);
+
+    long count = replay.load(path);
+    if (count < 0)
+    {
+        perror(path.c_str());
+        return 1;
+    }
+    printf("  Replay: %ld frame(s) loaded from %s\n", count, path.c_str());
+
+    if (replay.connectMembers() != 0)
+        return 1;
+
+    replay.run();
+    replay.report(stdout);
+    return 0;
+}
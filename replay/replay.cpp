@@ -0,0 +1,345 @@
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "replay.h"
+
+#define REPLAY_MARK 0x594C5052 /* "RPLY" after the send time in the pan */
+#define REPLAY_IDLE 2000       /* milliseconds without a frame before giving up */
+
+static int64_t steadyNanos()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+Replay::Replay(std::string remoteAddress, int remotePort, double speed)
+    : mSpeed(speed), mRunning(false), mSent(0), mReceived(0)
+{
+    memset(&mRemoteAddr, 0, sizeof(mRemoteAddr));
+    mRemoteAddr.sin_family = AF_INET;
+    mRemoteAddr.sin_addr.s_addr = inet_addr(remoteAddress.c_str());
+    mRemoteAddr.sin_port = htons(remotePort);
+
+    mEpoll = epoll_create1(0);
+    if (mEpoll < 0)
+        throw std::runtime_error("epoll_create1() failed");
+}
+
+Replay::~Replay()
+{
+    mRunning = false;
+    if (mReceiveHandler != nullptr)
+        mReceiveHandler->join();
+
+    for (auto& it : mMembers)
+        close(it.second.fd);
+    close(mEpoll);
+
+    if (mMapping != nullptr)
+        munmap(mMapping, mMappingSize);
+}
+
+long Replay::load(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = st.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+
+    /**********************************************/
+    /* A journal is replayed in place.            */
+    /**********************************************/
+    if (size >= JOURNAL_MAGIC_SIZE && memcmp(data, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) == 0)
+    {
+        madvise(data, size, MADV_SEQUENTIAL);
+        mMapping = data;
+        mMappingSize = size;
+        mRecords = (const journal_record_t*) ((const uint8_t*) data + JOURNAL_MAGIC_SIZE);
+        mCount = (size - JOURNAL_MAGIC_SIZE) / sizeof(journal_record_t);
+        return mCount;
+    }
+
+    long count;
+    uint32_t packetSize;
+    memcpy(&packetSize, data, sizeof(packetSize));
+    if (size % sizeof(isc_msg_t) == 0 && packetSize == sizeof(isc_msg_t) - sizeof(packetSize))
+    {
+        count = loadRaw((const uint8_t*) data, size);
+    }
+    else
+    {
+        FILE* file = fopen(path.c_str(), "r");
+        count = file != nullptr ? loadText(file) : -1;
+        if (file != nullptr)
+            fclose(file);
+    }
+
+    munmap(data, size);
+    mRecords = mConverted.data();
+    mCount = mConverted.size();
+    return count;
+}
+
+/**
+ * Raw frames carry no time, they are replayed back to back.
+ */
+long Replay::loadRaw(const uint8_t* data, size_t size)
+{
+    journal_record_t record = {};
+    for (size_t offset = 0; offset + sizeof(isc_msg_t) <= size; offset += sizeof(isc_msg_t))
+    {
+        memcpy(&record.frame, data + offset, sizeof(isc_msg_t));
+        mConverted.push_back(record);
+    }
+    return mConverted.size();
+}
+
+/**
+ * Rebuilds frames from the lines printed by Message::printData().
+ */
+long Replay::loadText(FILE* file)
+{
+    char line[256];
+    char kind[16];
+    int srcId, dstId;
+    unsigned mti;
+
+    journal_record_t record = {};
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        if (sscanf(line, "%15s message:\tmember(%d) received %u from member(%d)", kind, &dstId, &mti, &srcId) != 4)
+            continue;
+
+        Message message;
+        message.setId(srcId, dstId);
+        message.getMti() = mti;
+        message.setReply(strcmp(kind, "Reply") == 0);
+        memcpy(&record.frame, message.getData(), sizeof(isc_msg_t));
+        mConverted.push_back(record);
+    }
+    return mConverted.size();
+}
+
+int Replay::connectMembers()
+{
+    std::vector<int> ids;
+    for (size_t i = 0; i < mCount; i++)
+    {
+        Message message((const char*) &mRecords[i].frame);
+        for (int id : {message.getSrcId(), message.getDstId()})
+        {
+            if (id > 0 && mMembers.find(id) == mMembers.end())
+            {
+                mMembers[id] = VirtualMember{id, -1, std::string()};
+                ids.push_back(id);
+            }
+        }
+    }
+
+    for (int id : ids)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+        if (fd < 0 || connect(fd, (struct sockaddr*) &mRemoteAddr, sizeof(mRemoteAddr)) != 0)
+        {
+            fprintf(stderr, "  Replay: member (%d) failed to connect: %s\n", id, strerror(errno));
+            if (fd > -1)
+                close(fd);
+            return -1;
+        }
+
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*) &on, sizeof(on));
+
+        Message registration;
+        registration.setId(id, 0);
+        if (send(fd, registration.getData(), registration.getSize(), 0) != registration.getSize())
+        {
+            close(fd);
+            return -1;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(mEpoll, EPOLL_CTL_ADD, fd, &event);
+
+        mMembers[id].fd = fd;
+        mSockets[fd] = id;
+    }
+
+    // let the switch register everyone before traffic starts
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    fprintf(stdout, "  Replay: %lu member(s) connected\n", mMembers.size());
+    return 0;
+}
+
+void Replay::run()
+{
+    if (mCount == 0)
+        return;
+
+    mRunning = true;
+    mReceiveHandler = make_unique_cpp11<std::thread>([&]() { receiveHandler(); });
+
+    /**********************************************/
+    /* Inject in recorded order from one thread,  */
+    /* which keeps every member's order intact.   */
+    /**********************************************/
+    int64_t start = steadyNanos();
+    uint64_t firstTimestamp = mRecords[0].timestamp;
+    uint32_t mark = REPLAY_MARK;
+    isc_msg_t frame;
+
+    for (size_t i = 0; i < mCount; i++)
+    {
+        memcpy(&frame, &mRecords[i].frame, sizeof(frame));
+        Message message((const char*) &frame);
+        if (message.getDstId() <= 0)
+            continue;
+
+        auto member = mMembers.find(message.getSrcId());
+        if (member == mMembers.end())
+            continue;
+
+        if (mSpeed > 0 && mRecords[i].timestamp > firstTimestamp)
+        {
+            int64_t target = start + (int64_t) ((mRecords[i].timestamp - firstTimestamp) * 1000 / mSpeed);
+            int64_t wait = target - steadyNanos();
+            if (wait > 0)
+                std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+        }
+
+        int64_t now = steadyNanos();
+        memcpy(&frame.pan[0], &now, sizeof(now));
+        memcpy(&frame.pan[sizeof(now)], &mark, sizeof(mark));
+
+        size_t sent = 0;
+        while (sent < sizeof(frame))
+        {
+            int rc = send(member->second.fd, frame.ptr + sent, sizeof(frame) - sent, MSG_NOSIGNAL);
+            if (rc < 0)
+            {
+                fprintf(stderr, "  Replay: member (%d) lost its connection\n", member->first);
+                break;
+            }
+            sent += rc;
+        }
+        if (sent == sizeof(frame))
+            mSent++; // only these can come back
+    }
+    mExpected = mSent.load();
+
+    /**********************************************/
+    /* Wait for the routed frames to come back.   */
+    /**********************************************/
+    long received = -1;
+    int64_t lastProgress = steadyNanos();
+    while (mReceived.load() < mExpected)
+    {
+        if (mReceived.load() != received)
+        {
+            received = mReceived.load();
+            lastProgress = steadyNanos();
+        }
+        else if (steadyNanos() - lastProgress > (int64_t) REPLAY_IDLE * 1000000)
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    mElapsed = (steadyNanos() - start) / 1e9;
+
+    mRunning = false;
+    mReceiveHandler->join();
+    mReceiveHandler.reset();
+}
+
+void Replay::receiveHandler()
+{
+    struct epoll_event events[64];
+    char buffer[64 * 1024];
+
+    while (mRunning)
+    {
+        int n = epoll_wait(mEpoll, events, 64, 100);
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            int rc = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (rc <= 0)
+            {
+                if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    epoll_ctl(mEpoll, EPOLL_CTL_DEL, fd, nullptr);
+                continue;
+            }
+
+            VirtualMember& member = mMembers.at(mSockets.at(fd));
+            member.inBuffer.append(buffer, rc);
+
+            size_t offset = 0;
+            while (member.inBuffer.size() - offset >= sizeof(isc_msg_t))
+            {
+                onFrame((const uint8_t*) member.inBuffer.data() + offset);
+                offset += sizeof(isc_msg_t);
+            }
+            member.inBuffer.erase(0, offset);
+        }
+    }
+}
+
+void Replay::onFrame(const uint8_t* frame)
+{
+    int64_t sent;
+    uint32_t mark;
+    memcpy(&sent, frame + offsetof(isc_msg_t, pan), sizeof(sent));
+    memcpy(&mark, frame + offsetof(isc_msg_t, pan) + sizeof(sent), sizeof(mark));
+    if (mark != REPLAY_MARK)
+        return; // not injected by this run
+
+    mLatencies.push_back((steadyNanos() - sent) / 1000);
+    mReceived++;
+}
+
+void Replay::report(FILE* file)
+{
+    std::sort(mLatencies.begin(), mLatencies.end());
+    auto percentile = [&](double p) -> unsigned {
+        if (mLatencies.empty())
+            return 0;
+        return mLatencies[std::min(mLatencies.size() - 1, (size_t) (p * mLatencies.size()))];
+    };
+
+    long received = mReceived.load();
+    fprintf(file, "Replay report\n");
+    fprintf(file, "  members:    %lu\n", mMembers.size());
+    fprintf(file, "  sent:       %ld\n", mSent.load());
+    fprintf(file, "  routed:     %ld (%ld lost)\n", received, mExpected - received);
+    fprintf(file, "  elapsed:    %.3f s\n", mElapsed);
+    fprintf(file, "  throughput: %.0f msg/s\n", mElapsed > 0 ? received / mElapsed : 0.0);
+    fprintf(file, "  latency us: p50 %u, p90 %u, p99 %u, p99.9 %u, max %u\n", percentile(0.5), percentile(0.9),
+            percentile(0.99), percentile(0.999), mLatencies.empty() ? 0 : mLatencies.back());
+}
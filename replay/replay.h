@@ -0,0 +1,88 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <cstdio>
+#include <netinet/in.h>
+#include "isc_msg.h"
+#include "isc_journal.h"
+
+/**
+ * Replays recorded traffic against a running isc_challenge_server.
+ *
+ * Every member found in the recording gets a virtual connection that
+ * registers like Member does. Frames are then re-injected in recorded
+ * order, so the order of each member's traffic is kept, with their
+ * original spacing divided by the speed factor (0 = as fast as possible).
+ * Each injected frame carries its send time in the pan bytes, so the
+ * receiving side measures routing latency without any shared state.
+ */
+class Replay
+{
+  public:
+    Replay(std::string ipAddress = "127.0.0.1", int port = BASE_PORT, double speed = 1.0);
+    ~Replay();
+
+    /**
+     * Loads a binary journal (server -j), a file of raw isc_msg_t frames
+     * or the Logger's text output.
+     * @return the number of frames loaded, or -1
+     */
+    long load(const std::string& path);
+
+    /**
+     * Opens and registers one connection per member in the recording.
+     * @return 0 on success
+     */
+    int connectMembers();
+
+    /**
+     * Injects every frame and waits for them to be routed back.
+     */
+    void run();
+
+    void report(FILE* file);
+
+  private:
+    struct VirtualMember
+    {
+        int id;
+        int fd;
+        std::string inBuffer;
+    };
+
+    long loadRaw(const uint8_t* data, size_t size);
+    long loadText(FILE* file);
+    void receiveHandler();
+    void onFrame(const uint8_t* frame);
+
+    struct sockaddr_in mRemoteAddr;
+    double mSpeed;
+
+    // recording, either mapped in place or converted into mConverted
+    const journal_record_t* mRecords = nullptr;
+    size_t mCount = 0;
+    void* mMapping = nullptr;
+    size_t mMappingSize = 0;
+    std::vector<journal_record_t> mConverted{};
+
+    std::unordered_map<int, VirtualMember> mMembers{}; // id --> connection
+    std::unordered_map<int, int> mSockets{};            // socket --> id
+
+    int mEpoll = -1;
+    std::atomic_bool mRunning;
+    std::unique_ptr<std::thread> mReceiveHandler;
+
+    std::atomic<long> mSent;
+    std::atomic<long> mReceived;
+    long mExpected = 0;
+    double mElapsed = 0; // seconds
+    std::vector<uint32_t> mLatencies{}; // microseconds, owned by the receive thread
+};
+
+#endif // REPLAY_H
@@ -0,0 +1,374 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cluster.h"
+
+bool parsePeerList(const std::string& list, std::vector<PeerAddress>& peers)
+{
+    size_t start = 0;
+    while (start < list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+
+        std::string entry = list.substr(start, end - start);
+        size_t at = entry.find('@');
+        size_t colon = entry.rfind(':');
+        if (at == std::string::npos || colon == std::string::npos || colon < at)
+            return false;
+
+        PeerAddress peer;
+        peer.nodeId = atoi(entry.substr(0, at).c_str());
+        peer.host = entry.substr(at + 1, colon - at - 1);
+        peer.port = atoi(entry.substr(colon + 1).c_str());
+        if (peer.nodeId <= 0 || peer.port <= 0)
+            return false;
+
+        peers.push_back(peer);
+        start = end + 1;
+    }
+    return true;
+}
+
+Cluster::Cluster(int nodeId, std::vector<PeerAddress> peers)
+    : mNodeId(nodeId), mPeers(std::move(peers)), mRunning(false)
+{
+}
+
+Cluster::~Cluster()
+{
+    stop();
+
+    for (auto& it : mLinks)
+        close(it.first);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& it : mDialed)
+        close(it.first);
+}
+
+void Cluster::start(FdCallback onConnect, int stopFd)
+{
+    if (mRunning)
+        return;
+
+    mOnConnect = std::move(onConnect);
+    mStopFd = stopFd;
+    mRunning = true;
+    mDialHandler = make_unique_cpp11<std::thread>([&]() { dialHandler(); });
+}
+
+void Cluster::stop()
+{
+    mRunning = false;
+    if (mDialHandler != nullptr)
+    {
+        mDialHandler->join();
+        mDialHandler.reset();
+    }
+}
+
+/**
+ * Keeps a link open to every peer with a smaller node id,
+ * retrying once per second.
+ */
+void Cluster::dialHandler()
+{
+    while (mRunning)
+    {
+        for (auto& peer : mPeers)
+        {
+            if (peer.nodeId >= mNodeId)
+                continue;
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (mLiveNodes.count(peer.nodeId))
+                    continue;
+            }
+
+            int fd = dialPeer(peer);
+            if (fd < 0)
+                continue;
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mDialed[fd] = peer.nodeId;
+                mLiveNodes.insert(peer.nodeId); // until the link is reported down
+                mDialedNew = true;
+            }
+            fprintf(stdout, "  Cluster: connected to node (%d) at %s:%d\n", peer.nodeId, peer.host.c_str(), peer.port);
+            mOnConnect(fd);
+        }
+
+        struct pollfd pfd = {mStopFd, POLLIN, 0}; // ignored while -1
+        poll(&pfd, 1, 1000);
+    }
+}
+
+int Cluster::dialPeer(const PeerAddress& peer)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(peer.host.c_str());
+    addr.sin_port = htons(peer.port);
+
+    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*) &on, sizeof(on));
+
+    Message hello;
+    hello.getMti() = ISC_MTI_PEER_HELLO;
+    hello.setId(mNodeId, 0);
+    if (send(fd, hello.getData(), hello.getSize(), 0) != hello.getSize() ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void Cluster::adoptDialed()
+{
+    if (!mDialedNew.load())
+        return;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& it : mDialed)
+        mLinks.emplace(it.first, PeerLink{it.first, it.second, false, std::string(), std::string(), false});
+    mDialed.clear();
+    mDialedNew = false;
+}
+
+void Cluster::acceptPeer(int fd, Message& hello, const MemberTable& locals)
+{
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*) &on, sizeof(on));
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0)
+        perror("  Cluster: fcntl() failed");
+
+    fprintf(stdout, "  Cluster: node (%d) joined\n", hello.getSrcId());
+
+    Message reply;
+    reply.getMti() = ISC_MTI_PEER_HELLO;
+    reply.setId(mNodeId, 0);
+
+    mLinks[fd] = PeerLink{fd, hello.getSrcId(), false, std::string(), std::string(), false};
+    append(mLinks[fd], reply);
+    addLink(fd, hello.getSrcId(), locals);
+}
+
+/**
+ * Registers the node behind a link and sends it a snapshot of the
+ * members connected to this node.
+ */
+void Cluster::addLink(int fd, int nodeId, const MemberTable& locals)
+{
+    PeerLink& link = mLinks[fd];
+    link.nodeId = nodeId;
+    link.ready = true;
+    mNodeSockets[nodeId] = fd;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mLiveNodes.insert(nodeId);
+    }
+
+    Message up;
+    up.getMti() = ISC_MTI_MEMBER_UP;
+    locals.forEach([&](int id, Connection*) {
+        up.setId(id, mNodeId);
+        append(link, up);
+    });
+    flushLink(link);
+}
+
+void Cluster::onPeerData(int fd, const char* data, size_t len, const MemberTable& locals,
+                         const std::function<void(Message&)>& deliver)
+{
+    auto found = mLinks.find(fd);
+    if (found == mLinks.end())
+        found = mLinks.emplace(fd, PeerLink{fd, -1, false, std::string(), std::string(), false}).first;
+
+    PeerLink& link = found->second;
+    link.inBuffer.append(data, len);
+
+    /**********************************************/
+    /* Consume every complete frame, keep the     */
+    /* partial tail for the next read.            */
+    /**********************************************/
+    Message message;
+    size_t frameSize = message.getSize();
+    size_t offset = 0;
+    while (link.inBuffer.size() - offset >= frameSize)
+    {
+        memcpy(message.getData(), link.inBuffer.data() + offset, frameSize);
+        offset += frameSize;
+
+        if (message.getMti() >= ISC_MTI_PEER_HELLO && message.getMti() <= ISC_MTI_MEMBER_DOWN)
+            handleControl(link, message, locals);
+        else if (message.getDstId() > 0)
+            deliver(message);
+    }
+    link.inBuffer.erase(0, offset);
+}
+
+void Cluster::handleControl(PeerLink& link, Message& message, const MemberTable& locals)
+{
+    switch (message.getMti())
+    {
+    case ISC_MTI_PEER_HELLO:
+        if (!link.ready)
+        {
+            fprintf(stdout, "  Cluster: node (%d) answered\n", message.getSrcId());
+            addLink(link.fd, message.getSrcId(), locals);
+        }
+        break;
+    case ISC_MTI_MEMBER_UP:
+        mDirectory[message.getSrcId()] = message.getDstId();
+        mMembersUp = true;
+        break;
+    case ISC_MTI_MEMBER_DOWN: {
+        auto it = mDirectory.find(message.getSrcId());
+        if (it != mDirectory.end() && it->second == message.getDstId())
+            mDirectory.erase(it);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool Cluster::route(Message& message)
+{
+    auto it = mDirectory.find(message.getDstId());
+    if (it == mDirectory.end())
+        return false;
+
+    auto node = mNodeSockets.find(it->second);
+    if (node == mNodeSockets.end())
+        return false;
+
+    append(mLinks[node->second], message);
+    return true;
+}
+
+void Cluster::memberUp(int id)
+{
+    Message up;
+    up.getMti() = ISC_MTI_MEMBER_UP;
+    up.setId(id, mNodeId);
+    broadcast(up);
+}
+
+void Cluster::memberDown(int id)
+{
+    Message down;
+    down.getMti() = ISC_MTI_MEMBER_DOWN;
+    down.setId(id, mNodeId);
+    broadcast(down);
+}
+
+void Cluster::broadcast(Message& message)
+{
+    for (auto& it : mLinks)
+    {
+        if (it.second.ready)
+            append(it.second, message);
+    }
+}
+
+void Cluster::append(PeerLink& link, Message& message)
+{
+    link.outBuffer.append((const char*) message.getData(), message.getSize());
+    if (link.outBuffer.size() >= PEER_BATCH_FRAMES * (size_t) message.getSize() && flushLink(link) < 0)
+        link.broken = true;
+}
+
+void Cluster::flush(std::vector<int>& broken)
+{
+    for (auto& it : mLinks)
+    {
+        if (it.second.broken || flushLink(it.second) < 0)
+            broken.push_back(it.first);
+    }
+}
+
+bool Cluster::hasOutput(int fd) const
+{
+    auto found = mLinks.find(fd);
+    return found != mLinks.end() && !found->second.outBuffer.empty();
+}
+
+/**
+ * Writes as much of the link's output as the socket takes and keeps the
+ * rest for the next round.
+ * @return -1 if the link is broken
+ */
+int Cluster::flushLink(PeerLink& link)
+{
+    size_t sent = 0;
+    while (sent < link.outBuffer.size())
+    {
+        ssize_t rc = send(link.fd, link.outBuffer.data() + sent, link.outBuffer.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break; // the peer is behind, POLLOUT tells when to go on
+            perror("  Cluster: send() failed");
+            return -1;
+        }
+        sent += rc;
+    }
+    link.outBuffer.erase(0, sent);
+    return 0;
+}
+
+void Cluster::removePeer(int fd)
+{
+    auto found = mLinks.find(fd);
+    if (found == mLinks.end())
+        return;
+
+    int nodeId = found->second.nodeId;
+    mLinks.erase(found);
+    if (nodeId < 0)
+        return;
+
+    for (auto it = mDirectory.begin(); it != mDirectory.end();)
+    {
+        if (it->second == nodeId)
+            it = mDirectory.erase(it);
+        else
+            it++;
+    }
+
+    auto node = mNodeSockets.find(nodeId);
+    if (node != mNodeSockets.end() && node->second == fd)
+        mNodeSockets.erase(node);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mLiveNodes.erase(nodeId);
+    fprintf(stdout, "  Cluster: node (%d) left\n", nodeId);
+}
@@ -0,0 +1,175 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include "isc_msg.h"
+#include "registry.h"
+
+/*
+ * Control MTIs used on switch-to-switch peer links only. They are
+ * reserved values that a member never sends.
+ */
+#define ISC_MTI_PEER_HELLO  0xFFFFFF01 /* src_id = node id                      */
+#define ISC_MTI_MEMBER_UP   0xFFFFFF02 /* src_id = member id, dst_id = node id  */
+#define ISC_MTI_MEMBER_DOWN 0xFFFFFF03 /* src_id = member id, dst_id = node id  */
+
+#define PEER_BATCH_FRAMES 64 /* frames buffered per peer before an early flush */
+
+struct PeerAddress
+{
+    int nodeId;
+    std::string host;
+    int port;
+};
+
+/**
+ * Parses "id@host:port[,id@host:port...]" into a list of peers.
+ * @return false if any entry is malformed
+ */
+bool parsePeerList(const std::string& list, std::vector<PeerAddress>& peers);
+
+/**
+ * Connects a Switch to the other switch nodes of a cluster.
+ *
+ * Every node owns the members that are connected to it and announces
+ * them to its peers (MEMBER_UP / MEMBER_DOWN), so each node keeps a
+ * member-location directory (member id --> node id). Frames for a member
+ * owned by another node are appended to that peer's output buffer and
+ * written in batches by flush(). Peer sockets do not block: what a peer
+ * does not take yet stays buffered until its socket turns writable.
+ *
+ * A node dials only the peers with a smaller node id; the others dial it.
+ * All methods but start() must be called from the Switch's connection
+ * thread.
+ */
+class Cluster
+{
+  public:
+    using FdCallback = std::function<void(int)>;
+    using MemberTable = MemberRegistry; // local members
+
+    Cluster(int nodeId, std::vector<PeerAddress> peers);
+    ~Cluster();
+
+    /**
+     * Starts the dial thread. Every new peer socket is handed to onConnect
+     * so that the Switch can poll it.
+     * @param stopFd descriptor that turns readable when stop() is coming,
+     *               so that the thread does not finish its wait (optional)
+     */
+    void start(FdCallback onConnect, int stopFd = -1);
+    void stop();
+
+    int getNodeId() const
+    {
+        return mNodeId;
+    }
+
+    /**
+     * Takes over the sockets the dial thread opened since the last call,
+     * so that isPeer() needs no lock. Called before polling them.
+     */
+    void adoptDialed();
+
+    bool isPeer(int fd) const
+    {
+        return mLinks.count(fd) != 0;
+    }
+
+    /**
+     * Handles a PEER_HELLO received on a socket not yet known as a peer.
+     */
+    void acceptPeer(int fd, Message& hello, const MemberTable& locals);
+
+    /**
+     * Feeds raw bytes read from a peer socket. Complete data frames are
+     * passed to deliver; control frames update the directory.
+     */
+    void onPeerData(int fd, const char* data, size_t len, const MemberTable& locals,
+                    const std::function<void(Message&)>& deliver);
+
+    /**
+     * Queues a frame for the node that owns its destination.
+     * @return false if no peer owns the destination
+     */
+    bool route(Message& message);
+
+    void memberUp(int id);
+    void memberDown(int id);
+
+    /**
+     * @return true once after a peer announced a member, which may
+     *         resolve pending messages
+     */
+    bool takeMembersUp()
+    {
+        bool up = mMembersUp;
+        mMembersUp = false;
+        return up;
+    }
+
+    /**
+     * Writes every peer's batched output. Called once per poll round.
+     * @param broken receives the sockets of the links that failed, for
+     *               the caller to close
+     */
+    void flush(std::vector<int>& broken);
+
+    /**
+     * @return true if the peer behind fd has output left, so that its
+     *         socket should be polled for POLLOUT
+     */
+    bool hasOutput(int fd) const;
+
+    /**
+     * Forgets a peer socket and every member located behind it.
+     */
+    void removePeer(int fd);
+
+  private:
+    struct PeerLink
+    {
+        int fd;
+        int nodeId;
+        bool ready; // PEER_HELLO exchanged and snapshot sent
+        std::string inBuffer;
+        std::string outBuffer;
+        bool broken; // a write failed, flush() reports it
+    };
+
+    void dialHandler();
+    int dialPeer(const PeerAddress& peer);
+    void addLink(int fd, int nodeId, const MemberTable& locals);
+    void handleControl(PeerLink& link, Message& message, const MemberTable& locals);
+    void broadcast(Message& message);
+    void append(PeerLink& link, Message& message);
+    int flushLink(PeerLink& link);
+
+    int mNodeId;
+    std::vector<PeerAddress> mPeers;
+
+    std::unordered_map<int, PeerLink> mLinks{};     // socket --> peer link
+    std::unordered_map<int, int> mNodeSockets{};    // node id --> socket
+    std::unordered_map<int, int> mDirectory{};      // member id --> node id
+    bool mMembersUp = false;                        // MEMBER_UP since takeMembersUp()
+
+    std::mutex mMutex{};                        // guards mDialed and mLiveNodes
+    std::unordered_map<int, int> mDialed{};     // socket --> node id, opened by the dial thread
+    std::atomic_bool mDialedNew{false};         // mDialed holds sockets to adopt
+    std::set<int> mLiveNodes{}; // nodes with an established link
+
+    FdCallback mOnConnect;
+    int mStopFd = -1;
+    std::atomic_bool mRunning;
+    std::unique_ptr<std::thread> mDialHandler;
+};
+
+#endif // CLUSTER_H
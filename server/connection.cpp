@@ -0,0 +1,320 @@
+#include <cerrno>
+#include <algorithm>
+#include <climits>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "connection.h"
+
+int Connection::sendv(const struct iovec* iov, int count)
+{
+    mGathered.clear();
+    for (int i = 0; i < count; i++)
+        mGathered.append((const char*) iov[i].iov_base, iov[i].iov_len);
+    return send(mGathered.data(), mGathered.size());
+}
+
+SocketConnection::SocketConnection(int fd, const wire_state_t& state, const std::string& input)
+    : Connection(fd), mWire(state)
+{
+    mOutput.assign((const char*) state.tail, std::min((size_t) state.tailSize, sizeof(state.tail)));
+    mWire.tailSize = 0;
+
+    if (mWire.version == 1)
+        keepPartial(input.data(), std::min(input.size(), sizeof(isc_msg_t) - 1));
+    else
+        mInput = input;
+}
+
+SocketConnection::~SocketConnection()
+{
+    if (mAttachedFd > -1)
+        close(mAttachedFd);
+}
+
+int SocketConnection::receive(char* buffer, size_t size)
+{
+    if (mWire.version == 2)
+    {
+        /**********************************************/
+        /* Hand out what is decoded already before    */
+        /* reading more, the socket may be drained.   */
+        /**********************************************/
+        bool malformed = false;
+        size_t count = decodeInput(buffer, size, malformed);
+        if (count == 0 && !malformed)
+        {
+            char raw[4096];
+            int rc = recv(mFd, raw, sizeof(raw), MSG_DONTWAIT);
+            if (rc <= 0)
+                return rc;
+
+            mInput.append(raw, rc);
+            count = decodeInput(buffer, size, malformed);
+        }
+
+        if (count > 0)
+            return count;
+        errno = malformed ? EPROTO : EWOULDBLOCK;
+        return -1;
+    }
+
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int rc = recvmsg(mFd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (rc <= 0)
+        return rc;
+
+    /**********************************************/
+    /* Keep a descriptor a Unix-domain member     */
+    /* attached to its frame.                     */
+    /**********************************************/
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    {
+        if (mAttachedFd > -1)
+            close(mAttachedFd);
+        memcpy(&mAttachedFd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return rc;
+}
+
+int SocketConnection::send(const void* data, size_t size)
+{
+    if (mWire.version == 1)
+        return ::send(mFd, data, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    /**********************************************/
+    /* Finish the frame a full socket cut short   */
+    /* first, the caller passes it again.         */
+    /**********************************************/
+    size_t done = 0;
+    if (!mOutput.empty())
+    {
+        int rc = ::send(mFd, mOutput.data(), mOutput.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (rc < 0)
+            return -1;
+        mOutput.erase(0, rc);
+        if (!mOutput.empty())
+        {
+            errno = EWOULDBLOCK;
+            return -1;
+        }
+        done = sizeof(isc_msg_t);
+    }
+
+    isc_msg_t txPrev = mWire.txPrev;
+    uint8_t encoded[WIRE_V2_MAX_FRAME];
+    mEncoded.clear();
+    mEnds.clear();
+    for (size_t offset = done; offset + sizeof(isc_msg_t) <= size; offset += sizeof(isc_msg_t))
+    {
+        size_t count = wireEncode(mWire, (const uint8_t*) data + offset, encoded);
+        mEncoded.append((const char*) encoded, count);
+        mEnds.push_back(mEncoded.size());
+    }
+    if (mEncoded.empty())
+        return done;
+
+    int rc = ::send(mFd, mEncoded.data(), mEncoded.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (rc < 0)
+    {
+        mWire.txPrev = txPrev; // none of them went out
+        return done > 0 ? (int) done : -1;
+    }
+    if ((size_t) rc == mEncoded.size())
+        return size;
+
+    /**********************************************/
+    /* A frame is either sent or not: keep the    */
+    /* rest of the one cut short, the ones after  */
+    /* it are encoded again when passed again.    */
+    /**********************************************/
+    size_t sent = std::upper_bound(mEnds.begin(), mEnds.end(), (size_t) rc) - mEnds.begin();
+    size_t start = sent > 0 ? mEnds[sent - 1] : 0;
+    const uint8_t* frames = (const uint8_t*) data + done;
+    if ((size_t) rc > start)
+    {
+        mOutput.assign(mEncoded.data() + rc, mEnds[sent] - rc);
+        memcpy(&mWire.txPrev, frames + sent * sizeof(isc_msg_t), sizeof(isc_msg_t));
+    }
+    else if (sent > 0)
+    {
+        memcpy(&mWire.txPrev, frames + (sent - 1) * sizeof(isc_msg_t), sizeof(isc_msg_t));
+    }
+    else
+    {
+        mWire.txPrev = txPrev;
+    }
+
+    done += sent * sizeof(isc_msg_t);
+    if (done == 0)
+    {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+    return done;
+}
+
+int SocketConnection::sendv(const struct iovec* iov, int count)
+{
+    if (mWire.version != 1)
+        return Connection::sendv(iov, count); // encoded frame by frame anyway
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*) iov;
+    msg.msg_iovlen = std::min(count, IOV_MAX);
+    return sendmsg(mFd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+/**
+ * Decodes as many whole v2 frames as fit in buffer.
+ * @return the bytes of 36-byte frames written to buffer
+ */
+size_t SocketConnection::decodeInput(char* buffer, size_t size, bool& malformed)
+{
+    size_t consumed = 0;
+    size_t produced = 0;
+
+    while (size - produced >= sizeof(isc_msg_t))
+    {
+        int rc = wireDecode(mWire, (const uint8_t*) mInput.data() + consumed, mInput.size() - consumed,
+                            (uint8_t*) buffer + produced);
+        if (rc <= 0)
+        {
+            malformed = rc < 0;
+            break;
+        }
+        consumed += rc;
+        produced += sizeof(isc_msg_t);
+    }
+
+    mInput.erase(0, consumed);
+    return produced;
+}
+
+bool SocketConnection::setWireVersion(int version)
+{
+    if (version != 1 && version != 2)
+        return false;
+
+    wireReset(mWire, version);
+    mInput.clear();
+    return true;
+}
+
+void SocketConnection::saveWireState(wire_state_t& state) const
+{
+    state = mWire;
+    state.tailSize = std::min(mOutput.size(), sizeof(state.tail));
+    memcpy(state.tail, mOutput.data(), state.tailSize);
+}
+
+void SocketConnection::saveInput(std::string& input) const
+{
+    Connection::saveInput(input); // the head of a v1 frame
+    input.append(mInput);
+}
+
+int SocketConnection::takeAttachedFd()
+{
+    int fd = mAttachedFd;
+    mAttachedFd = -1;
+    return fd;
+}
+
+ShmConnection::~ShmConnection()
+{
+    munmap(mRegion, sizeof(shm_region_t));
+}
+
+shm_region_t* ShmConnection::map(int memFd)
+{
+    // unsealed, the member could truncate the file and fault us on the next access
+    struct stat st;
+    int seals = fcntl(memFd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(memFd, &st) != 0 || (size_t) st.st_size < sizeof(shm_region_t))
+        return nullptr;
+
+    void* data = mmap(nullptr, sizeof(shm_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+    if (data == MAP_FAILED)
+        return nullptr;
+
+    shm_region_t* region = (shm_region_t*) data;
+    if (region->magic != SHM_MAGIC || region->size != sizeof(shm_region_t))
+    {
+        munmap(data, sizeof(shm_region_t));
+        return nullptr;
+    }
+    return region;
+}
+
+int ShmConnection::receive(char* buffer, size_t size)
+{
+    /**********************************************/
+    /* Doorbells first, then the ring, so that a  */
+    /* frame behind a drained doorbell is seen.   */
+    /**********************************************/
+    char doorbells[256];
+    while (true)
+    {
+        int rc = recv(mFd, doorbells, sizeof(doorbells), MSG_DONTWAIT);
+        if (rc == 0)
+            return 0; // member closed its socket
+        if (rc < 0)
+        {
+            if (errno != EWOULDBLOCK && errno != EAGAIN)
+                return -1;
+            break;
+        }
+    }
+
+    bool notify = false;
+    size_t count = ringRead(&mRegion->up, buffer, size, notify);
+    if (notify)
+    {
+        char doorbell = 0;
+        ::send(mFd, &doorbell, sizeof(doorbell), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    if (count == 0)
+    {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+    return count;
+}
+
+/**
+ * Writes the frames the ring has room for, like a non-blocking socket.
+ * The member rings once it made room for the rest.
+ */
+int ShmConnection::send(const void* data, size_t size)
+{
+    bool notify = false;
+    size_t count = ringWriteSome(&mRegion->down, data, size, notify);
+    if (notify)
+    {
+        char doorbell = 0;
+        ::send(mFd, &doorbell, sizeof(doorbell), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+
+    if (count == 0)
+    {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+    return count;
+}
@@ -0,0 +1,205 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include <poll.h>
+#include "isc_msg.h"
+#include "isc_shm.h"
+#include "isc_codec.h"
+
+/**
+ * Transport of one member, keyed by the descriptor the Switch polls.
+ *
+ * receive() never blocks: it returns the number of bytes read, 0 once the
+ * member is gone, or -1 with errno set (EWOULDBLOCK when drained). send()
+ * returns size once the whole buffer is queued, or -1; a transport that
+ * cannot wait may queue fewer bytes, or fail with EWOULDBLOCK when it
+ * takes none, and tells what to poll for until it can. Both deal in
+ * 36-byte frames whatever the wire format is, but a stream may be read
+ * in the middle of one; the Switch keeps its head with the connection
+ * until the rest comes in. The descriptor stays owned by the Switch.
+ */
+class Connection
+{
+  public:
+    explicit Connection(int fd) : mFd(fd)
+    {
+    }
+    virtual ~Connection() = default;
+
+    int getFd() const
+    {
+        return mFd;
+    }
+
+    /**
+     * Member registered on this connection, -1 until its first frame.
+     */
+    int getMemberId() const
+    {
+        return mMemberId;
+    }
+    void setMemberId(int id)
+    {
+        mMemberId = id;
+    }
+
+    /**
+     * Copies the head of a frame left over by the last read to buffer.
+     * @return its size, less than a frame
+     */
+    size_t copyPartial(char* buffer) const
+    {
+        memcpy(buffer, mPartial, mPartialSize);
+        return mPartialSize;
+    }
+    void keepPartial(const char* data, size_t size)
+    {
+        memcpy(mPartial, data, size);
+        mPartialSize = size;
+    }
+
+    virtual int receive(char* buffer, size_t size) = 0;
+    virtual int send(const void* data, size_t size) = 0;
+
+    /**
+     * Sends count buffers of whole frames as one. Transports that cannot
+     * gather copy them together and send() that.
+     * @return the bytes queued, fewer than given if the socket is full, or -1
+     */
+    virtual int sendv(const struct iovec* iov, int count);
+
+    /**
+     * @return the poll() events telling that a full transport has room again
+     */
+    virtual short getWritableEvents() const
+    {
+        return POLLOUT;
+    }
+
+    /**
+     * @return a descriptor passed along with the received data, or -1
+     */
+    virtual int takeAttachedFd()
+    {
+        return -1;
+    }
+
+    virtual bool isSharedMemory() const
+    {
+        return false;
+    }
+
+    /**
+     * Switches the wire format, after the member has been acknowledged.
+     * @return false if this transport cannot carry it
+     */
+    virtual bool setWireVersion(int version)
+    {
+        return version == 1;
+    }
+
+    /**
+     * Codec state, handed to a successor process with the socket.
+     */
+    virtual void saveWireState(wire_state_t& state) const
+    {
+        wireReset(state, 1);
+    }
+
+    /**
+     * Appends what was received and not handed out yet, for a successor
+     * process: the head of a frame, or input not decoded yet.
+     */
+    virtual void saveInput(std::string& input) const
+    {
+        input.append(mPartial, mPartialSize);
+    }
+
+  protected:
+    int mFd;
+    int mMemberId = -1;
+
+  private:
+    std::string mGathered{}; // sendv() buffers copied together
+    char mPartial[sizeof(isc_msg_t)];
+    size_t mPartialSize = 0;
+};
+
+/**
+ * TCP and Unix-domain stream sockets, in either wire format.
+ */
+class SocketConnection : public Connection
+{
+  public:
+    explicit SocketConnection(int fd) : Connection(fd)
+    {
+        wireReset(mWire, 1);
+    }
+
+    /**
+     * Carries on with the codec state and the input of a predecessor
+     * process, see saveWireState() and saveInput().
+     */
+    SocketConnection(int fd, const wire_state_t& state, const std::string& input);
+    ~SocketConnection() override;
+
+    int receive(char* buffer, size_t size) override;
+    int send(const void* data, size_t size) override;
+    int sendv(const struct iovec* iov, int count) override;
+    int takeAttachedFd() override;
+    bool setWireVersion(int version) override;
+    void saveWireState(wire_state_t& state) const override;
+    void saveInput(std::string& input) const override;
+
+  private:
+    size_t decodeInput(char* buffer, size_t size, bool& malformed);
+
+    int mAttachedFd = -1;
+    wire_state_t mWire;
+    std::string mInput{};       // v2 bytes not decoded yet
+    std::string mOutput{};      // v2 rest of a frame a full socket cut short
+    std::string mEncoded{};     // v2 bytes being sent
+    std::vector<size_t> mEnds{}; // end of each frame in mEncoded
+};
+
+/**
+ * Rings in a region mapped from a member's memfd. The socket carries the
+ * doorbells and tells us when the member is gone.
+ */
+class ShmConnection : public Connection
+{
+  public:
+    ShmConnection(int fd, shm_region_t* region) : Connection(fd), mRegion(region)
+    {
+    }
+    ~ShmConnection() override;
+
+    /**
+     * Maps and checks the region of memFd, which can be closed afterwards.
+     * @return nullptr if it is not a valid region
+     */
+    static shm_region_t* map(int memFd);
+
+    int receive(char* buffer, size_t size) override;
+    int send(const void* data, size_t size) override;
+
+    short getWritableEvents() const override
+    {
+        return POLLIN; // the member's doorbell
+    }
+
+    bool isSharedMemory() const override
+    {
+        return true;
+    }
+
+  private:
+    shm_region_t* mRegion;
+};
+
+#endif // CONNECTION_H
@@ -0,0 +1,110 @@
+#include <cstddef>
+#include <cstring>
+#include "decoder.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DECODER_X86
+#endif
+
+#define FRAME_SIZE ((int) sizeof(isc_msg_t))
+#define PACKET_SIZE ((uint32_t) (sizeof(isc_msg_t) - sizeof(uint32_t)))
+
+#define SRC_OFFSET offsetof(isc_msg_t, src_id)
+#define DST_OFFSET offsetof(isc_msg_t, dst_id)
+
+static inline uint32_t load32(const uint8_t* ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+/**
+ * Decodes frames [first, count) one by one.
+ */
+static int decodeScalar(const uint8_t* buffer, int first, int count, route_entry_t* routes)
+{
+    int n = 0;
+    for (int i = first; i < count; i++)
+    {
+        const uint8_t* frame = buffer + i * FRAME_SIZE;
+        if (load32(frame) != PACKET_SIZE)
+            continue;
+
+        routes[n].mti = load32(frame + offsetof(isc_msg_t, mti));
+        routes[n].srcId = load32(frame + SRC_OFFSET) & 0xffffff;
+        routes[n].dstId = load32(frame + DST_OFFSET) & 0xffffff;
+        routes[n].index = i;
+        n++;
+    }
+    return n;
+}
+
+#ifdef DECODER_X86
+/**
+ * Shuffles a frame header into the route_entry_t layout
+ * (mti, src, dst, packet_size).
+ */
+#define HEADER_SHUFFLE 4, 5, 6, 7, 8, 9, 10, -1, 11, 12, 13, -1, 0, 1, 2, 3
+
+/**
+ * 4 frames per step: each shuffled header is stored as is, the packet
+ * sizes are transposed into one vector to validate the 4 frames at once.
+ * AVX2 gathers and 2-frames-per-register shuffles were both measured
+ * slower than this at a 36-byte stride.
+ * @return the number of routes written, done is set to the frames consumed
+ */
+__attribute__((target("ssse3"))) static int decodeSsse3(const uint8_t* buffer, int count, route_entry_t* routes,
+                                                        int& done)
+{
+    const __m128i shuffle = _mm_setr_epi8(HEADER_SHUFFLE);
+    const __m128i packetSize = _mm_set1_epi32(PACKET_SIZE);
+
+    int n = 0;
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const uint8_t* ptr = buffer + i * FRAME_SIZE;
+
+        __m128i f0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) ptr), shuffle);
+        __m128i f1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (ptr + FRAME_SIZE)), shuffle);
+        __m128i f2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (ptr + 2 * FRAME_SIZE)), shuffle);
+        __m128i f3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (ptr + 3 * FRAME_SIZE)), shuffle);
+
+        __m128i sizes = _mm_unpackhi_epi64(_mm_unpackhi_epi32(f0, f1), _mm_unpackhi_epi32(f2, f3));
+        int valid = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(sizes, packetSize)));
+
+        _mm_storeu_si128((__m128i*) &routes[n], f0);
+        routes[n].index = i;
+        n += valid & 1;
+        _mm_storeu_si128((__m128i*) &routes[n], f1);
+        routes[n].index = i + 1;
+        n += (valid >> 1) & 1;
+        _mm_storeu_si128((__m128i*) &routes[n], f2);
+        routes[n].index = i + 2;
+        n += (valid >> 2) & 1;
+        _mm_storeu_si128((__m128i*) &routes[n], f3);
+        routes[n].index = i + 3;
+        n += (valid >> 3) & 1;
+    }
+
+    done = i;
+    return n;
+}
+#endif // DECODER_X86
+
+int decodeFrames(const uint8_t* buffer, int count, route_entry_t* routes)
+{
+    int n = 0;
+    int done = 0;
+
+#ifdef DECODER_X86
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+
+    if (ssse3)
+        n = decodeSsse3(buffer, count, routes, done);
+#endif
+
+    return n + decodeScalar(buffer, done, count, routes + n);
+}
@@ -0,0 +1,28 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <cstdint>
+#include "isc_msg.h"
+
+#define DECODE_BATCH_FRAMES 32 /* frames read and decoded per batch */
+
+// routing fields of one valid frame
+typedef struct
+{
+    uint32_t mti;
+    int32_t srcId;
+    int32_t dstId;
+    int32_t index; // position of the frame in the decoded buffer
+} route_entry_t;
+
+/**
+ * Decodes count back-to-back isc_msg_t frames at once. Frames whose
+ * packet_size is not sizeof(isc_msg_t) - 4 are skipped, the others are
+ * written to routes in order. routes must have room for count entries.
+ *
+ * Uses SSSE3 shuffles when the CPU has them, with a scalar fallback.
+ * @return the number of entries written to routes
+ */
+int decodeFrames(const uint8_t* buffer, int count, route_entry_t* routes);
+
+#endif // DECODER_H
@@ -0,0 +1,106 @@
+#include "dedup.h"
+#include "isc_seq.h"
+
+#define DEDUP_USED 0x1
+#define DEDUP_REPLIED 0x2
+
+static uint32_t idOf(const uint8_t* id)
+{
+    return id[0] | (id[1] << 8) | (id[2] << 16);
+}
+
+static size_t hashOf(uint64_t key1, uint64_t key2)
+{
+    uint64_t hash = (key1 ^ (key2 << 29 | key2 >> 35)) * 0x9E3779B97F4A7C15ull;
+    return hash >> (64 - DEDUP_SLOT_BITS);
+}
+
+DedupCache::DedupCache(uint32_t windowMs)
+    : mWindow(windowMs), mEntries(DEDUP_SLOTS, DedupEntry{0, 0, 0, 0}), mReplies(DEDUP_SLOTS)
+{
+}
+
+/**
+ * @param victim set to the slot a new key would take
+ * @return the slot holding the key, or -1
+ */
+int DedupCache::find(uint64_t key1, uint64_t key2, uint32_t now, int* victim) const
+{
+    size_t base = hashOf(key1, key2);
+    int oldest = -1;
+    int free = -1;
+
+    for (size_t i = 0; i < DEDUP_PROBES; i++)
+    {
+        int slot = (base + i) & (DEDUP_SLOTS - 1);
+        const DedupEntry& entry = mEntries[slot];
+        if (!isLive(entry, now))
+        {
+            if (free < 0)
+                free = slot;
+            continue;
+        }
+        if (entry.key1 == key1 && entry.key2 == key2)
+            return slot;
+        if (oldest < 0 || now - entry.seen > now - mEntries[oldest].seen)
+            oldest = slot;
+    }
+
+    if (victim != nullptr)
+        *victim = free > -1 ? free : oldest;
+    return -1;
+}
+
+DedupCache::Verdict DedupCache::check(const isc_msg_t& frame, uint64_t now, isc_msg_t& reply)
+{
+    if (!hasSequence(frame))
+        return Fresh;
+
+    uint32_t time = (uint32_t) now;
+    uint64_t trace = getSequence(frame);
+    uint64_t key1 = (uint64_t) frame.mti.val << 32 | (uint64_t) (frame.trace[0] != 0) << 31 | idOf(frame.src_id);
+    uint64_t key2 = (uint64_t) idOf(frame.dst_id) << 40 | trace;
+
+    int victim = -1;
+    int slot = find(key1, key2, time, &victim);
+    if (slot > -1)
+    {
+        if (frame.trace[0] == 0 && (mEntries[slot].flags & DEDUP_REPLIED))
+        {
+            reply = mReplies[slot];
+            return Answered;
+        }
+        return Duplicate;
+    }
+
+    mEntries[victim] = DedupEntry{key1, key2, time, DEDUP_USED};
+
+    /**********************************************/
+    /* Keep a reply with its request, for the     */
+    /* retransmissions still to come.             */
+    /**********************************************/
+    if (frame.trace[0] != 0)
+    {
+        uint64_t requestKey1 = (uint64_t) (frame.mti.val - 10) << 32 | idOf(frame.dst_id);
+        uint64_t requestKey2 = (uint64_t) idOf(frame.src_id) << 40 | trace;
+        int request = find(requestKey1, requestKey2, time, nullptr);
+        if (request > -1)
+        {
+            mReplies[request] = frame;
+            mEntries[request].flags |= DEDUP_REPLIED;
+        }
+    }
+    return Fresh;
+}
+
+void DedupCache::sweep(uint64_t now)
+{
+    uint32_t time = (uint32_t) now;
+    for (size_t i = 0; i < DEDUP_SWEEP_SLOTS; i++)
+    {
+        DedupEntry& entry = mEntries[mSweepCursor];
+        if (entry.flags != 0 && !isLive(entry, time))
+            entry.flags = 0; // before its clock wraps around
+        mSweepCursor = (mSweepCursor + 1) & (DEDUP_SLOTS - 1);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <cstdint>
+#include <vector>
+#include "isc_msg.h"
+
+#define DEDUP_SLOT_BITS 16
+#define DEDUP_SLOTS (1 << DEDUP_SLOT_BITS) /* frames remembered at most      */
+#define DEDUP_PROBES 8                     /* adjacent slots searched per key */
+#define DEDUP_SWEEP_SLOTS 1024             /* slots aged per loop round       */
+
+/**
+ * Time-windowed duplicate detection on the ingress path.
+ *
+ * Frames are keyed on (src_id, dst_id, mti, reply flag, trace[1..5]);
+ * members stamp a sequence in the trace, so a key seen again within the
+ * window is a retransmission. A reply is also kept with the request it
+ * answers, so that a retransmitted request can be answered in place of
+ * its destination. Frames still carrying the default trace of Message
+ * cannot be told apart and are never tracked.
+ *
+ * Open addressing over a fixed table: a key lives in one of the
+ * DEDUP_PROBES slots after its hash, taking the first free or expired
+ * one, or else the oldest. Nothing is allocated after construction.
+ */
+class DedupCache
+{
+  public:
+    enum Verdict
+    {
+        Fresh,     // first sighting, forward it
+        Duplicate, // seen within the window, drop it
+        Answered   // request whose reply is cached, send that instead
+    };
+
+    explicit DedupCache(uint32_t windowMs);
+
+    /**
+     * Records frame as seen at now (milliseconds).
+     * @param reply set to the cached reply when Answered is returned
+     */
+    Verdict check(const isc_msg_t& frame, uint64_t now, isc_msg_t& reply);
+
+    /**
+     * Frees the expired entries of the next DEDUP_SWEEP_SLOTS slots.
+     */
+    void sweep(uint64_t now);
+
+  private:
+    struct DedupEntry
+    {
+        uint64_t key1;  // mti, reply flag, src_id
+        uint64_t key2;  // dst_id, trace
+        uint32_t seen;  // milliseconds, wraps
+        uint32_t flags; // DEDUP_USED, DEDUP_REPLIED
+    };
+
+    int find(uint64_t key1, uint64_t key2, uint32_t now, int* victim) const;
+    bool isLive(const DedupEntry& entry, uint32_t now) const
+    {
+        return entry.flags != 0 && now - entry.seen < mWindow;
+    }
+
+    uint32_t mWindow;
+    std::vector<DedupEntry> mEntries;
+    std::vector<isc_msg_t> mReplies; // by slot, valid with DEDUP_REPLIED
+    size_t mSweepCursor = 0;
+};
+
+#endif // DEDUP_H
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cstring>
+#include "framepool.h"
+
+FrameRef::FrameRef(FrameSlab* slab, const isc_msg_t* frame) : mSlab(slab), mFrame(frame)
+{
+    if (mSlab != nullptr)
+        mSlab->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameRef::reset()
+{
+    if (mSlab != nullptr && mSlab->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        mSlab->pool->recycle(mSlab);
+    mSlab = nullptr;
+    mFrame = nullptr;
+}
+
+FramePool::FramePool(size_t slabs)
+{
+    for (size_t i = 0; i < slabs; i++)
+        mFree.push_back(grow());
+}
+
+uint8_t* FramePool::reserve(size_t size)
+{
+    if (mCurrent == nullptr || FRAME_SLAB_SIZE - mCurrent->used < size)
+    {
+        /**********************************************/
+        /* Drop our hold of the full slab, it is free */
+        /* again once its last frame is released.     */
+        /**********************************************/
+        if (mCurrent != nullptr && mCurrent->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            recycle(mCurrent);
+
+        mCurrent = allocate();
+        mCurrent->refs.store(1, std::memory_order_relaxed);
+        mCurrent->used = 0;
+    }
+    return mCurrent->data + mCurrent->used;
+}
+
+FrameRef FramePool::commit(size_t size)
+{
+    FrameRef frame(mCurrent, (const isc_msg_t*) (mCurrent->data + mCurrent->used));
+    mCurrent->used += size;
+    return frame;
+}
+
+FrameRef FramePool::copy(const void* frame)
+{
+    memcpy(reserve(sizeof(isc_msg_t)), frame, sizeof(isc_msg_t));
+    return commit(sizeof(isc_msg_t));
+}
+
+FrameRef FramePool::compact(const FrameRef& frame)
+{
+    FrameSlab* slab = frame.mSlab;
+    if (slab == nullptr || slab == mCurrent)
+        return frame;
+
+    size_t held = slab->refs.load(std::memory_order_relaxed) * sizeof(isc_msg_t);
+    return held * FRAME_SPARSE_RATIO < slab->used ? copy(frame.get()) : frame;
+}
+
+bool FramePool::isFull()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSlabs.size() >= FRAME_POOL_MAX_SLABS && mFree.empty();
+}
+
+void FramePool::trim()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    while (mSlabs.size() > FRAME_POOL_SLABS && !mFree.empty())
+    {
+        FrameSlab* slab = mFree.back();
+        mFree.pop_back();
+        mSlabs.erase(std::find_if(mSlabs.begin(), mSlabs.end(),
+                                  [slab](const std::unique_ptr<FrameSlab>& it) { return it.get() == slab; }));
+    }
+}
+
+/**
+ * @return a free slab, a new one if none is left
+ */
+FrameSlab* FramePool::allocate()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mFree.empty())
+    {
+        FrameSlab* slab = mFree.back();
+        mFree.pop_back();
+        return slab;
+    }
+    return grow();
+}
+
+FrameSlab* FramePool::grow()
+{
+    mSlabs.emplace_back(new FrameSlab);
+    FrameSlab* slab = mSlabs.back().get();
+    slab->refs.store(0, std::memory_order_relaxed);
+    slab->used = 0;
+    slab->pool = this;
+    return slab;
+}
+
+void FramePool::recycle(FrameSlab* slab)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFree.push_back(slab);
+}
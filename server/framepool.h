@@ -0,0 +1,194 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "isc_msg.h"
+
+#define FRAME_SLAB_SIZE (64 * 1024) /* bytes received into one slab      */
+#define FRAME_POOL_SLABS 16         /* slabs allocated up front          */
+#define FRAME_POOL_MAX_SLABS 512    /* slabs before reading stops        */
+#define FRAME_SPARSE_RATIO 8        /* a slab 1/8 referenced is sparse   */
+
+class FramePool;
+
+/**
+ * A block that received bytes land in. It goes back to its pool when the
+ * last reference to one of its frames is dropped.
+ */
+struct FrameSlab
+{
+    std::atomic<int> refs;
+    size_t used; // bytes handed out, written by the pool's owner only
+    FramePool* pool;
+    uint8_t data[FRAME_SLAB_SIZE];
+};
+
+/**
+ * Counted reference to one frame of a slab. Copies share the frame, the
+ * last one to go frees the slab; they may be dropped on any thread.
+ *
+ * A borrowed reference points at a frame outside the pool and holds
+ * nothing, FramePool::keep() copies it into the pool when it has to
+ * outlive the caller.
+ */
+class FrameRef
+{
+  public:
+    FrameRef() = default;
+    FrameRef(FrameSlab* slab, const isc_msg_t* frame);
+    FrameRef(const FrameRef& other) : FrameRef(other.mSlab, other.mFrame)
+    {
+    }
+    FrameRef(FrameRef&& other) noexcept : mSlab(other.mSlab), mFrame(other.mFrame)
+    {
+        other.mSlab = nullptr;
+        other.mFrame = nullptr;
+    }
+    ~FrameRef()
+    {
+        reset();
+    }
+
+    FrameRef& operator=(FrameRef other) noexcept
+    {
+        std::swap(mSlab, other.mSlab);
+        std::swap(mFrame, other.mFrame);
+        return *this;
+    }
+
+    static FrameRef borrow(const void* frame)
+    {
+        return FrameRef(nullptr, (const isc_msg_t*) frame);
+    }
+
+    /**
+     * @return a reference to the index-th frame after this one, in the
+     * same slab
+     */
+    FrameRef slice(size_t index) const
+    {
+        return FrameRef(mSlab, mFrame + index);
+    }
+
+    void reset();
+
+    const isc_msg_t& operator*() const
+    {
+        return *mFrame;
+    }
+    const isc_msg_t* operator->() const
+    {
+        return mFrame;
+    }
+    const isc_msg_t* get() const
+    {
+        return mFrame;
+    }
+
+    bool isPooled() const
+    {
+        return mSlab != nullptr;
+    }
+
+    /**
+     * @return true if other's frame directly follows this one in memory
+     */
+    bool precedes(const FrameRef& other) const
+    {
+        return mSlab != nullptr && mSlab == other.mSlab && mFrame + 1 == other.mFrame;
+    }
+
+  private:
+    friend class FramePool;
+
+    FrameSlab* mSlab = nullptr; // null when borrowed
+    const isc_msg_t* mFrame = nullptr;
+};
+
+/**
+ * Receive buffers of the routing loop, shared by every stage a frame
+ * goes through: a socket is read straight into the free tail of the
+ * current slab and the lanes and the Logger keep references into it, so
+ * a frame is never copied between its receive and its send.
+ *
+ * Only the thread that owns the pool reserves and commits; references may
+ * be released from any thread, but not after the pool is destroyed. Slabs
+ * are recycled, and more are allocated when every one of them is still
+ * referenced. The owner stops reading once there are FRAME_POOL_MAX_SLABS
+ * and gives the slabs of a burst back with trim(). One frame holds its
+ * whole slab: frames held for long are moved out of sparse slabs with
+ * compact().
+ */
+class FramePool
+{
+  public:
+    explicit FramePool(size_t slabs = FRAME_POOL_SLABS);
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    /**
+     * @return room for size bytes, moving on to another slab when the
+     * current one has less. size may not exceed FRAME_SLAB_SIZE.
+     */
+    uint8_t* reserve(size_t size);
+
+    /**
+     * Hands out size bytes written at the last reserve().
+     * @return a reference to the first frame of them
+     */
+    FrameRef commit(size_t size);
+
+    /**
+     * @return a reference to a copy of frame in the pool
+     */
+    FrameRef copy(const void* frame);
+
+    /**
+     * @return frame itself if it is in the pool, else a copy
+     */
+    FrameRef keep(const FrameRef& frame)
+    {
+        return frame.isPooled() ? frame : copy(frame.get());
+    }
+
+    /**
+     * @return frame itself, or a copy if its slab is mostly released
+     */
+    FrameRef compact(const FrameRef& frame);
+
+    size_t getSlabCount() const
+    {
+        return mSlabs.size();
+    }
+
+    /**
+     * @return true if FRAME_POOL_MAX_SLABS are allocated and all in use
+     */
+    bool isFull();
+
+    /**
+     * Frees the unused slabs beyond FRAME_POOL_SLABS.
+     */
+    void trim();
+
+  private:
+    friend class FrameRef;
+
+    FrameSlab* allocate();
+    FrameSlab* grow();
+    void recycle(FrameSlab* slab);
+
+    FrameSlab* mCurrent = nullptr; // being filled, the pool holds a reference
+    std::vector<std::unique_ptr<FrameSlab>> mSlabs{}; // grown by the owner only
+
+    std::mutex mMutex{}; // guards mFree
+    std::vector<FrameSlab*> mFree{};
+};
+
+#endif // FRAMEPOOL_H
@@ -0,0 +1,330 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "handoff.h"
+
+#define HANDOFF_TIMEOUT 5000 /* milliseconds to wait for the other process */
+
+static int fillAddress(const std::string& path, struct sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return -1;
+
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return 0;
+}
+
+/**
+ * Sends one packet, optionally carrying sockets as SCM_RIGHTS.
+ */
+static int sendPacket(int fd, const void* data, size_t size, const int* fds, size_t count)
+{
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (count > 0)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    }
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t) size ? 0 : -1;
+}
+
+/**
+ * Receives one packet and the sockets attached to it.
+ * @return the packet size, or -1
+ */
+static int recvPacket(int fd, void* data, size_t size, std::vector<int>& fds)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, HANDOFF_TIMEOUT) <= 0)
+        return -1;
+
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int rc = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (rc <= 0)
+        return -1;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* received = (const int*) CMSG_DATA(cmsg);
+        fds.insert(fds.end(), received, received + count);
+    }
+    return rc;
+}
+
+Handoff::~Handoff()
+{
+    if (mListenSocket > -1)
+        close(mListenSocket);
+}
+
+int Handoff::listen(const std::string& path)
+{
+    struct sockaddr_un addr;
+    if (fillAddress(path, addr) != 0)
+    {
+        fprintf(stderr, "  Handoff: path too long: %s\n", path.c_str());
+        return -1;
+    }
+
+    mListenSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (mListenSocket < 0)
+    {
+        perror("  Handoff: socket() failed");
+        return -1;
+    }
+
+    unlink(path.c_str()); // a predecessor's path is ours now
+    if (bind(mListenSocket, (struct sockaddr*) &addr, sizeof(addr)) != 0 || ::listen(mListenSocket, 1) != 0)
+    {
+        perror("  Handoff: bind() failed");
+        close(mListenSocket);
+        mListenSocket = -1;
+        return -1;
+    }
+
+    mPath = path;
+    return 0;
+}
+
+int Handoff::acceptSuccessor()
+{
+    if (mListenSocket < 0)
+        return -1;
+
+    int fd = accept(mListenSocket, nullptr, nullptr);
+    if (fd < 0)
+        return -1;
+
+    int off = 0;
+    ioctl(fd, FIONBIO, (char*) &off);
+    return fd;
+}
+
+int Handoff::send(int fd, const HandoffState& state)
+{
+    /**********************************************/
+    /* Cut what the sockets buffered into packets */
+    /* first, their number goes into the header.  */
+    /**********************************************/
+    std::vector<std::string> buffers;
+    for (size_t i = 0; i < state.sockets.size(); i++)
+    {
+        const std::string& input = state.inputs[i];
+        const std::string& unsent = state.unsent[i];
+        size_t inputSent = 0;
+        size_t unsentSent = 0;
+        while (inputSent < input.size() || unsentSent < unsent.size())
+        {
+            handoff_buffers_t buffer;
+            buffer.index = i;
+            buffer.inputSize = std::min((size_t) HANDOFF_MAX_INPUT, input.size() - inputSent);
+            buffer.unsentCount = std::min((size_t) HANDOFF_MAX_FRAMES, (unsent.size() - unsentSent) / sizeof(isc_msg_t));
+            buffer.unsentOffset = unsentSent == 0 ? state.unsentOffsets[i] : 0;
+
+            std::string packet((const char*) &buffer, sizeof(buffer));
+            packet.append(input, inputSent, buffer.inputSize);
+            packet.append(unsent, unsentSent, buffer.unsentCount * sizeof(isc_msg_t));
+            buffers.push_back(std::move(packet));
+            inputSent += buffer.inputSize;
+            unsentSent += buffer.unsentCount * sizeof(isc_msg_t);
+        }
+    }
+
+    handoff_header_t header;
+    header.magic = HANDOFF_MAGIC;
+    header.socketCount = state.sockets.size();
+    header.pendingCount = state.pending.size();
+    header.listenCount = state.unixListenSocket > -1 ? 2 : 1;
+    header.bufferCount = buffers.size();
+
+    int listenSockets[2] = {state.listenSocket, state.unixListenSocket};
+    if (sendPacket(fd, &header, sizeof(header), listenSockets, header.listenCount) != 0)
+        return -1;
+
+    /**********************************************/
+    /* Member sockets, with the id behind each.   */
+    /**********************************************/
+    for (size_t i = 0; i < state.sockets.size(); i += HANDOFF_MAX_FDS)
+    {
+        size_t count = std::min((size_t) HANDOFF_MAX_FDS, state.sockets.size() - i);
+        if (sendPacket(fd, &state.memberIds[i], sizeof(int) * count, &state.sockets[i], count) != 0)
+            return -1;
+    }
+
+    /**********************************************/
+    /* Codec state of every socket, same order.   */
+    /**********************************************/
+    for (size_t i = 0; i < state.wireStates.size(); i += HANDOFF_MAX_STATES)
+    {
+        size_t count = std::min((size_t) HANDOFF_MAX_STATES, state.wireStates.size() - i);
+        if (sendPacket(fd, &state.wireStates[i], sizeof(wire_state_t) * count, nullptr, 0) != 0)
+            return -1;
+    }
+
+    /**********************************************/
+    /* Pending messages, oldest first.            */
+    /**********************************************/
+    isc_msg_t frames[HANDOFF_MAX_FRAMES];
+    for (size_t i = 0; i < state.pending.size(); i += HANDOFF_MAX_FRAMES)
+    {
+        size_t count = std::min((size_t) HANDOFF_MAX_FRAMES, state.pending.size() - i);
+        for (size_t j = 0; j < count; j++)
+            memcpy(&frames[j], &state.pending[i + j], sizeof(isc_msg_t));
+
+        if (sendPacket(fd, frames, sizeof(isc_msg_t) * count, nullptr, 0) != 0)
+            return -1;
+    }
+
+    /**********************************************/
+    /* Input not routed and frames not written.   */
+    /**********************************************/
+    for (auto& packet : buffers)
+    {
+        if (sendPacket(fd, packet.data(), packet.size(), nullptr, 0) != 0)
+            return -1;
+    }
+
+    char ack;
+    std::vector<int> none;
+    return recvPacket(fd, &ack, sizeof(ack), none) == 1 ? 0 : -1;
+}
+
+int Handoff::receive(const std::string& path, HandoffState& state)
+{
+    struct sockaddr_un addr;
+    if (fillAddress(path, addr) != 0)
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+    {
+        perror("  Handoff: connect() failed");
+        close(fd);
+        return -1;
+    }
+
+    std::vector<int> fds;
+    handoff_header_t header;
+    if (recvPacket(fd, &header, sizeof(header), fds) != sizeof(header) || header.magic != HANDOFF_MAGIC ||
+        fds.size() != header.listenCount || fds.empty())
+    {
+        fprintf(stderr, "  Handoff: bad header from %s\n", path.c_str());
+        close(fd);
+        return -1;
+    }
+    state.listenSocket = fds[0];
+    state.unixListenSocket = fds.size() > 1 ? fds[1] : -1;
+
+    int ids[HANDOFF_MAX_FDS];
+    while (state.sockets.size() < header.socketCount)
+    {
+        fds.clear();
+        int rc = recvPacket(fd, ids, sizeof(ids), fds);
+        if (rc < 0 || fds.size() != rc / sizeof(int))
+        {
+            fprintf(stderr, "  Handoff: lost sockets from %s\n", path.c_str());
+            close(fd);
+            return -1;
+        }
+        state.sockets.insert(state.sockets.end(), fds.begin(), fds.end());
+        state.memberIds.insert(state.memberIds.end(), ids, ids + fds.size());
+    }
+
+    wire_state_t wireStates[HANDOFF_MAX_STATES];
+    while (state.wireStates.size() < header.socketCount)
+    {
+        int rc = recvPacket(fd, wireStates, sizeof(wireStates), fds);
+        if (rc <= 0 || rc % sizeof(wire_state_t) != 0)
+        {
+            fprintf(stderr, "  Handoff: lost wire states from %s\n", path.c_str());
+            close(fd);
+            return -1;
+        }
+        state.wireStates.insert(state.wireStates.end(), wireStates, wireStates + rc / sizeof(wire_state_t));
+    }
+
+    isc_msg_t frames[HANDOFF_MAX_FRAMES];
+    while (state.pending.size() < header.pendingCount)
+    {
+        int rc = recvPacket(fd, frames, sizeof(frames), fds);
+        if (rc < 0)
+            break;
+
+        for (size_t i = 0; i < rc / sizeof(isc_msg_t); i++)
+            state.pending.emplace_back((const char*) &frames[i]);
+    }
+
+    state.inputs.resize(header.socketCount);
+    state.unsent.resize(header.socketCount);
+    state.unsentOffsets.resize(header.socketCount);
+    std::vector<char> packet(sizeof(handoff_buffers_t) + HANDOFF_MAX_INPUT + HANDOFF_MAX_FRAMES * sizeof(isc_msg_t));
+    for (size_t i = 0; i < header.bufferCount; i++)
+    {
+        int rc = recvPacket(fd, packet.data(), packet.size(), fds);
+        const handoff_buffers_t& buffer = *(const handoff_buffers_t*) packet.data();
+        if (rc < (int) sizeof(buffer) || buffer.index >= header.socketCount ||
+            (size_t) rc != sizeof(buffer) + buffer.inputSize + buffer.unsentCount * sizeof(isc_msg_t))
+        {
+            fprintf(stderr, "  Handoff: lost buffered data from %s\n", path.c_str());
+            close(fd);
+            return -1;
+        }
+
+        const char* data = packet.data() + sizeof(buffer);
+        if (state.unsent[buffer.index].empty())
+            state.unsentOffsets[buffer.index] = buffer.unsentOffset;
+        state.inputs[buffer.index].append(data, buffer.inputSize);
+        state.unsent[buffer.index].append(data + buffer.inputSize, buffer.unsentCount * sizeof(isc_msg_t));
+    }
+    return fd;
+}
+
+void Handoff::acknowledge(int fd)
+{
+    char ack = 1;
+    sendPacket(fd, &ack, sizeof(ack), nullptr, 0);
+    close(fd);
+}
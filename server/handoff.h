@@ -0,0 +1,104 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <string>
+#include <vector>
+#include "isc_msg.h"
+#include "isc_codec.h"
+
+#define HANDOFF_MAGIC 0x15C0FF03
+#define HANDOFF_MAX_FDS 128       /* sockets passed per SCM_RIGHTS packet  */
+#define HANDOFF_MAX_STATES 64     /* wire states passed per packet         */
+#define HANDOFF_MAX_FRAMES 256    /* pending or unsent frames per packet   */
+#define HANDOFF_MAX_INPUT 4096    /* input bytes passed per packet         */
+
+// first packet of a handoff, carries the listening socket(s)
+typedef struct
+{
+    uint32_t magic;
+    uint32_t socketCount;
+    uint32_t pendingCount;
+    uint32_t listenCount; // 2 when the Unix-domain listener follows the TCP one
+    uint32_t bufferCount; // packets of buffered data after the pending messages
+} handoff_header_t;
+
+// what a member socket buffered, followed by inputSize bytes and unsentCount frames
+typedef struct
+{
+    uint32_t index;        // of the socket
+    uint32_t inputSize;    // received, not routed yet
+    uint32_t unsentCount;  // routed, not written yet
+    uint32_t unsentOffset; // bytes of the first unsent frame written already
+} handoff_buffers_t;
+
+/**
+ * Everything a new Switch process needs to carry on routing: the
+ * listening sockets, the member sockets with the member id registered on
+ * each of them (-1 if none yet), their wire format state and what was
+ * buffered for them either way, and the unresolved pending messages.
+ */
+struct HandoffState
+{
+    int listenSocket = -1;
+    int unixListenSocket = -1;
+    std::vector<int> sockets{};
+    std::vector<int> memberIds{};
+    std::vector<wire_state_t> wireStates{};
+    std::vector<std::string> inputs{};      // by socket, see Connection::saveInput()
+    std::vector<std::string> unsent{};      // by socket, 36-byte frames
+    std::vector<uint32_t> unsentOffsets{};  // by socket
+    std::vector<Message> pending{};
+};
+
+/**
+ * Hot restart over a Unix-domain SOCK_SEQPACKET socket.
+ *
+ * The running Switch listens on a path. A new process connects to it,
+ * receives the state above (the sockets travel as SCM_RIGHTS), takes over
+ * the path for its own successor and acknowledges, after which the old
+ * process stops routing and exits. Member connections are never closed,
+ * the kernel keeps them open as long as one process holds them.
+ */
+class Handoff
+{
+  public:
+    Handoff() = default;
+    ~Handoff();
+
+    /**
+     * Listens for a successor on path (old process side).
+     */
+    int listen(const std::string& path);
+
+    int getSocket() const
+    {
+        return mListenSocket;
+    }
+
+    /**
+     * Non-blocking check for a successor.
+     * @return the connection to the successor, or -1
+     */
+    int acceptSuccessor();
+
+    /**
+     * Sends state to the successor and waits for its acknowledgement.
+     * @return 0 once the successor owns the sockets
+     */
+    int send(int fd, const HandoffState& state);
+
+    /**
+     * Connects to the running process at path and receives its state
+     * (new process side). The caller must acknowledge() once it is
+     * ready to route.
+     * @return the connection to the old process, or -1
+     */
+    static int receive(const std::string& path, HandoffState& state);
+    static void acknowledge(int fd);
+
+  private:
+    std::string mPath;
+    int mListenSocket = -1;
+};
+
+#endif // HANDOFF_H
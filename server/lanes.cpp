@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include "lanes.h"
+
+LaneScheduler::LaneScheduler()
+{
+    for (int i = 0; i < LANE_CLASSES; i++)
+        mWeights[i] = 1;
+}
+
+bool LaneScheduler::parseClasses(const std::string& spec)
+{
+    std::vector<MtiRange> ranges;
+    size_t start = 0;
+    while (start < spec.size())
+    {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos)
+            end = spec.size();
+
+        std::string entry = spec.substr(start, end - start);
+        size_t equal = entry.find('=');
+        if (equal == std::string::npos || equal == 0 || equal + 1 == entry.size())
+            return false;
+
+        MtiRange range;
+        range.lane = atoi(entry.substr(0, equal).c_str());
+        std::string mtis = entry.substr(equal + 1);
+        size_t dash = mtis.find('-');
+        range.first = strtoul(mtis.substr(0, dash).c_str(), nullptr, 0);
+        range.last = dash == std::string::npos ? range.first : strtoul(mtis.substr(dash + 1).c_str(), nullptr, 0);
+        if (range.lane < 0 || range.lane >= LANE_CLASSES || range.last < range.first)
+            return false;
+
+        ranges.push_back(range);
+        start = end + 1;
+    }
+
+    std::sort(ranges.begin(), ranges.end(), [](const MtiRange& a, const MtiRange& b) { return a.first < b.first; });
+    for (size_t i = 1; i < ranges.size(); i++)
+    {
+        if (ranges[i].first <= ranges[i - 1].last)
+            return false; // overlapping ranges
+    }
+
+    mRanges = std::move(ranges);
+    return true;
+}
+
+bool LaneScheduler::parseWeights(const std::string& spec)
+{
+    int weights[LANE_CLASSES];
+    int count = 0;
+    size_t start = 0;
+    while (start < spec.size())
+    {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos)
+            end = spec.size();
+        if (count == LANE_CLASSES)
+            return false;
+
+        weights[count] = atoi(spec.substr(start, end - start).c_str());
+        if (weights[count] <= 0)
+            return false;
+        count++;
+        start = end + 1;
+    }
+    if (count == 0)
+        return false;
+
+    // classes left out get the weight of the last one given
+    for (int i = 0; i < LANE_CLASSES; i++)
+        mWeights[i] = weights[i < count ? i : count - 1];
+    mWeighted = true;
+    return true;
+}
+
+int LaneScheduler::classify(uint32_t mti) const
+{
+    auto it = std::upper_bound(mRanges.begin(), mRanges.end(), mti,
+                               [](uint32_t value, const MtiRange& range) { return value < range.first; });
+    if (it == mRanges.begin())
+        return LANE_DEFAULT_CLASS;
+
+    --it;
+    return mti <= it->last ? it->lane : LANE_DEFAULT_CLASS;
+}
+
+bool OutputLanes::push(int lane, const FrameRef& frame)
+{
+    bool wasEmpty = empty(); // a blocked destination is listed already
+    mQueues[lane].push_back(frame);
+    mPending |= 1u << lane;
+    mSize++;
+    return wasEmpty;
+}
+
+int OutputLanes::topLane() const
+{
+    return mPending == 0 ? LANE_CLASSES : __builtin_ctz(mPending);
+}
+
+size_t OutputLanes::drain(const LaneScheduler& scheduler, std::vector<FrameRef>& out)
+{
+    size_t offset = mUnsentOffset;
+    std::move(mUnsent.begin(), mUnsent.end(), std::back_inserter(out));
+    mUnsent.clear();
+    mUnsentOffset = 0;
+    mSize = 0;
+
+    if (!scheduler.isWeighted())
+    {
+        for (int lane = topLane(); lane < LANE_CLASSES; lane++)
+            std::move(mQueues[lane].begin(), mQueues[lane].end(), std::back_inserter(out));
+        clearQueues();
+        return offset;
+    }
+
+    /**********************************************/
+    /* Take up to weight frames from every class  */
+    /* in turn until all of them are empty.       */
+    /**********************************************/
+    size_t offsets[LANE_CLASSES] = {0};
+    bool left = true;
+    while (left)
+    {
+        left = false;
+        for (int lane = 0; lane < LANE_CLASSES; lane++)
+        {
+            std::vector<FrameRef>& queue = mQueues[lane];
+            size_t count = std::min(queue.size() - offsets[lane], (size_t) scheduler.getWeight(lane));
+            std::move(queue.begin() + offsets[lane], queue.begin() + offsets[lane] + count, std::back_inserter(out));
+            offsets[lane] += count;
+            left = left || offsets[lane] < queue.size();
+        }
+    }
+    clearQueues();
+    return offset;
+}
+
+void OutputLanes::keepUnsent(std::vector<FrameRef>& frames, size_t first, size_t offset)
+{
+    std::move(frames.begin() + first, frames.end(), std::back_inserter(mUnsent));
+    mUnsentOffset = offset;
+    mSize += frames.size() - first;
+}
+
+void OutputLanes::compact(FramePool& pool)
+{
+    for (auto& frame : mUnsent)
+        frame = pool.compact(frame);
+    for (auto& queue : mQueues)
+    {
+        for (auto& frame : queue)
+            frame = pool.compact(frame);
+    }
+}
+
+void OutputLanes::clear()
+{
+    clearQueues();
+    mUnsent.clear();
+    mUnsentOffset = 0;
+    mSize = 0;
+    mStalledSince = 0;
+}
+
+void OutputLanes::clearQueues()
+{
+    for (auto& queue : mQueues)
+        queue.clear();
+    mPending = 0;
+}
@@ -0,0 +1,143 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "isc_msg.h"
+#include "framepool.h"
+
+#define LANE_CLASSES 4       /* priority classes, 0 is the most urgent     */
+#define LANE_DEFAULT_CLASS 2 /* class of an MTI that no range mentions     */
+#define LANE_MAX_FRAMES 4096 /* frames held for a destination before its senders are paused */
+
+/**
+ * MTI --> priority class table and the policy used to flush the classes.
+ *
+ * Classes are given as "class=mti[-mti],..." e.g. "0=800-899,1=100-199"
+ * for network management ahead of authorisations. Weights are given as
+ * "w0,w1,..." frames per round-robin turn; without weights the classes
+ * are flushed in strict priority order.
+ */
+class LaneScheduler
+{
+  public:
+    LaneScheduler();
+
+    /**
+     * @return false if spec is malformed, the table is then left unchanged
+     */
+    bool parseClasses(const std::string& spec);
+    bool parseWeights(const std::string& spec);
+
+    int classify(uint32_t mti) const;
+
+    bool isWeighted() const
+    {
+        return mWeighted;
+    }
+
+    int getWeight(int lane) const
+    {
+        return mWeights[lane];
+    }
+
+  private:
+    struct MtiRange
+    {
+        uint32_t first;
+        uint32_t last;
+        int lane;
+    };
+
+    std::vector<MtiRange> mRanges{}; // sorted by first MTI, not overlapping
+    int mWeights[LANE_CLASSES];
+    bool mWeighted = false;
+};
+
+/**
+ * Frames routed to one destination and not written yet, one FIFO per
+ * class. Frames of the same class keep their order. The lanes hold
+ * references to the frames where they were received. Frames drained but
+ * not taken by a full transport are kept apart and go out first.
+ */
+class OutputLanes
+{
+  public:
+    /**
+     * @return true if the lanes were empty before
+     */
+    bool push(int lane, const FrameRef& frame);
+
+    bool empty() const
+    {
+        return mPending == 0 && mUnsent.empty();
+    }
+
+    /**
+     * @return the frames held, queued or unsent
+     */
+    size_t size() const
+    {
+        return mSize;
+    }
+
+    /**
+     * @return true if the destination did not take all of the last drain
+     */
+    bool isBlocked() const
+    {
+        return !mUnsent.empty();
+    }
+
+    /**
+     * @return the most urgent class holding frames, LANE_CLASSES if none
+     */
+    int topLane() const;
+
+    /**
+     * Moves every queued frame to out, the unsent ones first, then in the
+     * order the scheduler picks.
+     * @return the bytes of the first frame written already
+     */
+    size_t drain(const LaneScheduler& scheduler, std::vector<FrameRef>& out);
+
+    /**
+     * Keeps frames from first on for the next drain, the first offset
+     * bytes of frames[first] being written already.
+     */
+    void keepUnsent(std::vector<FrameRef>& frames, size_t first, size_t offset);
+
+    /**
+     * Moves the frames held out of sparse slabs, see FramePool::compact().
+     */
+    void compact(FramePool& pool);
+
+    /**
+     * Milliseconds the destination last took nothing since, 0 while it
+     * takes what it is given.
+     */
+    uint64_t getStalledSince() const
+    {
+        return mStalledSince;
+    }
+    void setStalledSince(uint64_t now)
+    {
+        mStalledSince = now;
+    }
+
+    void clear();
+
+  private:
+    void clearQueues();
+
+    std::vector<FrameRef> mQueues[LANE_CLASSES];
+    unsigned mPending = 0; // bit per non-empty class
+
+    std::vector<FrameRef> mUnsent{};
+    size_t mUnsentOffset = 0;
+    size_t mSize = 0;
+    uint64_t mStalledSince = 0;
+};
+
+#endif // LANES_H
@@ -0,0 +1,270 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/msg.h>
+#include "logger.h"
+
+bool parseLogMode(const char* name, LogMode& mode)
+{
+    if (strcmp(name, "thread") == 0)
+        mode = LogMode::Thread;
+    else if (strcmp(name, "fork") == 0)
+        mode = LogMode::Fork;
+    else if (strcmp(name, "external") == 0)
+        mode = LogMode::External;
+    else
+        return false;
+    return true;
+}
+
+key_t logDaemonKey()
+{
+    int fd = open(LOG_KEY_FILE, O_RDONLY | O_CREAT, 0644);
+    if (fd > -1)
+        close(fd);
+    return ftok(LOG_KEY_FILE, 'B');
+}
+
+/*
+ * Two decimal digits per entry, so that numbers are written two digits
+ * at a time, and the "%d" text of every byte value for trace and pan.
+ */
+static const char sDigitPairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                                  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                                  "8081828384858687888990919293949596979899";
+
+struct ByteText
+{
+    char text[3];
+    uint8_t size;
+};
+
+static const struct ByteTable
+{
+    ByteText entries[256];
+
+    ByteTable() : entries()
+    {
+        char text[4];
+        for (int i = 0; i < 256; i++)
+        {
+            entries[i].size = snprintf(text, sizeof(text), "%d", i);
+            memcpy(entries[i].text, text, sizeof(entries[i].text));
+        }
+    }
+} sByteTable;
+
+/**
+ * printf("%0<width>u")
+ */
+static char* putUnsigned(char* out, uint32_t value, int width = 1)
+{
+    char digits[10];
+    char* end = digits + sizeof(digits);
+    char* ptr = end;
+
+    while (value >= 100)
+    {
+        ptr -= 2;
+        memcpy(ptr, sDigitPairs + (value % 100) * 2, 2);
+        value /= 100;
+    }
+    if (value >= 10)
+    {
+        ptr -= 2;
+        memcpy(ptr, sDigitPairs + value * 2, 2);
+    }
+    else
+    {
+        *--ptr = '0' + value;
+    }
+
+    for (int count = end - ptr; count < width; count++)
+        *out++ = '0';
+    memcpy(out, ptr, end - ptr);
+    return out + (end - ptr);
+}
+
+/**
+ * printf("%0<width>d"), the sign counts towards the width
+ */
+static char* putSigned(char* out, int32_t value, int width = 1)
+{
+    if (value >= 0)
+        return putUnsigned(out, value, width);
+
+    *out++ = '-';
+    return putUnsigned(out, 0u - (uint32_t) value, width - 1);
+}
+
+static char* putText(char* out, const char* text, size_t size)
+{
+    memcpy(out, text, size);
+    return out + size;
+}
+
+#define PUT_LITERAL(out, text) putText(out, text, sizeof(text) - 1)
+
+size_t formatMessage(const isc_msg_t& frame, char* out)
+{
+    char* ptr = out;
+    int32_t srcId = frame.src_id[0] | (frame.src_id[1] << 8) | (frame.src_id[2] << 16);
+    int32_t dstId = frame.dst_id[0] | (frame.dst_id[1] << 8) | (frame.dst_id[2] << 16);
+
+    if (!frame.trace[0])
+        ptr = PUT_LITERAL(ptr, "Request message:\tmember(");
+    else
+        ptr = PUT_LITERAL(ptr, "Reply message:\tmember(");
+    ptr = putSigned(ptr, dstId);
+    ptr = PUT_LITERAL(ptr, ") received ");
+    ptr = putUnsigned(ptr, frame.mti.val);
+    ptr = PUT_LITERAL(ptr, " from member(");
+    ptr = putUnsigned(ptr, srcId);
+    ptr = PUT_LITERAL(ptr, ")\t");
+
+    ptr = putSigned(ptr, srcId, 3);
+    ptr = putSigned(ptr, (int32_t) frame.mti.val, 4);
+    for (uint8_t byte : frame.trace)
+    {
+        memcpy(ptr, sByteTable.entries[byte].text, 3); // the table pads, size tells what counts
+        ptr += sByteTable.entries[byte].size;
+    }
+    for (uint8_t byte : frame.pan)
+    {
+        memcpy(ptr, sByteTable.entries[byte].text, 3);
+        ptr += sByteTable.entries[byte].size;
+    }
+    ptr = putSigned(ptr, dstId, 3);
+    *ptr++ = '\n';
+
+    return ptr - out;
+}
+
+void LogBatch::flush()
+{
+    if (mSize == 0)
+        return;
+
+    fflush(mFilePtr); // keep the order of whatever stdio buffered before us
+
+    size_t written = 0;
+    while (written < mSize)
+    {
+        ssize_t rc = write(fileno(mFilePtr), mBuffer.data() + written, mSize - written);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("  Logger: write() failed");
+            break;
+        }
+        written += rc;
+    }
+    mSize = 0;
+}
+
+QueueLogChannel::~QueueLogChannel()
+{
+    if (mDropped > 0)
+        fprintf(stderr, "  Logger: %lu line(s) dropped, the queue was full\n", mDropped);
+    if (!mStopLogger)
+        return;
+
+    /**********************************************/
+    /* A Logger that died leaves the queue full,  */
+    /* do not wait for it forever.                */
+    /**********************************************/
+    ipc_msg_t ipcMsg;
+    ipcMsg.type = LOG_QUIT_TYPE;
+    for (int attempt = 0; attempt < LOG_QUIT_ATTEMPTS; attempt++)
+    {
+        if (msgsnd(mQueueId, &ipcMsg, sizeof(ipcMsg.text), IPC_NOWAIT) == 0)
+            return;
+        if (errno != EAGAIN)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    perror("  Logger: msgsnd() of quit failed");
+}
+
+void QueueLogChannel::post(const FrameRef& frame)
+{
+    ipc_msg_t ipcMsg;
+
+    // write message to Logger process's IPCQ
+    ipcMsg.type = LOG_MSG_TYPE;
+    fillRecord(*(journal_record_t*) ipcMsg.text, *frame);
+    if (msgsnd(mQueueId, &ipcMsg, sizeof(ipcMsg.text), IPC_NOWAIT) != 0)
+        mDropped++; // the Logger is behind or gone, routing does not wait
+}
+
+ThreadLogChannel::ThreadLogChannel(FILE* file, FILE* journal) : mFilePtr(file), mJournal(journal)
+{
+    mLogHandler = make_unique_cpp11<std::thread>([&]() { logHandler(); });
+}
+
+ThreadLogChannel::~ThreadLogChannel()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_one();
+    mLogHandler->join();
+    fflush(mFilePtr);
+    if (mDropped > 0)
+        fprintf(stderr, "  Logger: %lu line(s) dropped, the queue was full\n", mDropped);
+
+    if (mJournal != nullptr)
+        fclose(mJournal);
+}
+
+void ThreadLogChannel::post(const FrameRef& frame)
+{
+    uint64_t timestamp = journalClock();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mQueue.size() >= LOG_THREAD_QUEUE)
+        {
+            mDropped++; // the thread is behind, routing does not wait
+            return;
+        }
+        mQueue.push_back(LogEntry{timestamp, frame});
+    }
+    mCondition.notify_one();
+}
+
+void ThreadLogChannel::logHandler()
+{
+    std::deque<LogEntry> batch;
+    LogBatch output(mFilePtr);
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [&]() { return mStopping || !mQueue.empty(); });
+            if (mQueue.empty())
+                break; // stopping and drained
+
+            batch.swap(mQueue);
+        }
+
+        for (auto& entry : batch)
+        {
+            output.add(*entry.frame);
+
+            if (mJournal != nullptr)
+            {
+                journal_record_t record;
+                fillRecord(record, *entry.frame, entry.timestamp);
+                fwrite(&record, sizeof(record), 1, mJournal);
+            }
+        }
+        output.flush();
+        batch.clear(); // the last references free the receive slabs
+    }
+}
@@ -0,0 +1,155 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <condition_variable>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include "isc_msg.h"
+#include "isc_journal.h"
+#include "framepool.h"
+
+#define LOG_MSG_TYPE 123          /* ipc_msg_t.type of a routed message        */
+#define LOG_QUIT_TYPE 124         /* ipc_msg_t.type asking the Logger to stop  */
+#define LOG_KEY_FILE "iscChallenge.isc" /* ftok() path of the logger daemon    */
+#define LOG_LINE_MAX 192          /* longest line formatMessage() writes       */
+#define LOG_BATCH_RECORDS 4096    /* records formatted per write()             */
+#define LOG_QUIT_ATTEMPTS 100     /* 10 ms tries to queue LOG_QUIT_TYPE        */
+#define LOG_THREAD_QUEUE 65536    /* frames ThreadLogChannel holds, at most    */
+
+/*
+ * Where the Logger runs:
+ *   thread   - an asynchronous thread inside the Switch process
+ *   fork     - a child process fed through a private SysV message queue
+ *   external - an already-running logger daemon (isc_challenge_server -L)
+ */
+enum class LogMode
+{
+    Thread,
+    Fork,
+    External
+};
+
+bool parseLogMode(const char* name, LogMode& mode);
+
+/**
+ * Key of the logger daemon's message queue. The key file is created if
+ * needed so that ftok() never fails.
+ */
+key_t logDaemonKey();
+
+/**
+ * Renders frame exactly like Message::printData() does, without stdio.
+ * out needs LOG_LINE_MAX bytes.
+ * @return the number of characters written (no terminator)
+ */
+size_t formatMessage(const isc_msg_t& frame, char* out);
+
+/**
+ * Formats records back to back into one buffer and hands it to the
+ * descriptor behind file with a single write().
+ */
+class LogBatch
+{
+  public:
+    explicit LogBatch(FILE* file) : mFilePtr(file), mBuffer(LOG_BATCH_RECORDS * LOG_LINE_MAX)
+    {
+    }
+
+    void add(const isc_msg_t& frame)
+    {
+        mSize += formatMessage(frame, &mBuffer[mSize]);
+        if (mBuffer.size() - mSize < LOG_LINE_MAX)
+            flush();
+    }
+
+    void flush();
+
+  private:
+    FILE* mFilePtr;
+    std::vector<char> mBuffer;
+    size_t mSize = 0;
+};
+
+/**
+ * Producer side of the Logger, owned by the Switch. post() is called on
+ * the routing path and must not block on formatting or file I/O. frame
+ * is a pooled reference, a channel may keep it until it is written.
+ */
+class LogChannel
+{
+  public:
+    virtual ~LogChannel() = default;
+
+    virtual void post(const FrameRef& frame) = 0;
+};
+
+/**
+ * Feeds a Logger process through a SysV message queue.
+ */
+class QueueLogChannel : public LogChannel
+{
+  public:
+    /**
+     * post() never waits for the Logger: a line that does not fit into a
+     * full queue is dropped and counted.
+     * @param stopLogger send LOG_QUIT_TYPE on destruction, so that a
+     *                   forked Logger exits once it has drained the queue
+     */
+    QueueLogChannel(int queueId, bool stopLogger) : mQueueId(queueId), mStopLogger(stopLogger)
+    {
+    }
+    ~QueueLogChannel() override;
+
+    void post(const FrameRef& frame) override;
+
+  private:
+    int mQueueId;
+    bool mStopLogger;
+    unsigned long mDropped = 0; // lines the full queue did not take
+};
+
+/**
+ * In-process Logger: post() appends a reference to the frame to a queue
+ * that a background thread prints, the frame itself is not copied.
+ * Destruction prints everything posted before it returns. Like a full
+ * SysV queue, a full queue drops the line: the frames it holds keep
+ * their receive slabs from being reused.
+ */
+class ThreadLogChannel : public LogChannel
+{
+  public:
+    /**
+     * @param journal binary journal to append records to, closed on
+     *                destruction (optional)
+     */
+    explicit ThreadLogChannel(FILE* file = stdout, FILE* journal = nullptr);
+    ~ThreadLogChannel() override;
+
+    void post(const FrameRef& frame) override;
+
+  private:
+    struct LogEntry
+    {
+        uint64_t timestamp; // journalClock() when posted
+        FrameRef frame;
+    };
+
+    void logHandler();
+
+    FILE* mFilePtr;
+    FILE* mJournal;
+    std::deque<LogEntry> mQueue{};
+    bool mStopping = false;
+    unsigned long mDropped = 0; // lines the full queue did not take
+
+    std::mutex mMutex{};
+    std::condition_variable mCondition{};
+    std::unique_ptr<std::thread> mLogHandler;
+};
+
+#endif // LOGGER_H
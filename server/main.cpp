@@ -12,18 +12,50 @@
  */
 #include <unistd.h>
 #include <signal.h>
+#include <poll.h>
 #include <sys/wait.h>
+#include <sys/eventfd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 #include "server.h"
 #include "isc_msg.h"
 
 /** G L O B A L  V A R I A B L E S **********************************/
 int pid = -1;
 std::atomic<bool> quit(false);
+int quitFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC); // readable after SIGINT
 
 /** P R I V A T E  F U N C T I O N S ********************************/
-static void sig_handler(int sig)
+static void sig_handler(int)
 {
     quit.store(true);
+
+    uint64_t one = 1;
+    if (write(quitFd, &one, sizeof(one)) < 0)
+        return; // quit is set all the same
+}
+
+/**
+ * Blocks until SIGINT or until the server stops by itself.
+ */
+static void waitForServer(ServerBase& server)
+{
+    struct pollfd pfds[2] = {{quitFd, POLLIN, 0}, {server.getStopFd(), POLLIN, 0}};
+    while (server.isRunning() && !quit.load())
+        poll(pfds, 2, TIMEOUT);
+}
+
+/**
+ * Waits for a forked Logger to print its queue and removes the queue.
+ */
+static void stopLogger(int queueId)
+{
+    if (pid > 0)
+    {
+        waitpid(pid, nullptr, 0);
+        msgctl(queueId, IPC_RMID, nullptr);
+    }
 }
 
 /*
@@ -33,9 +65,28 @@ int main(int argc, char* argv[])
 {
     int port = BASE_PORT;
     int numConns = 999;
+    int nodeId = 0;
+    std::vector<PeerAddress> peers;
+    std::string storeDir;
+    int storeTtl = 3600;
+    std::string handoffPath;
+    std::string unixPath;
+    std::string laneClasses;
+    std::string laneWeights;
+    int requestTimeout = 0;
+    int pendingTtl = 0;
+    int idleTimeout = 0;
+    int dedupWindow = 0;
+    int shutdownDeadline = SHUTDOWN_DEADLINE;
+    bool checkOrder = false;
+    bool takeover = false;
+    LogMode logMode = LogMode::Fork;
+    bool runLogger = false;
+    const char* journalPath = nullptr;
+    FILE* journal = nullptr;
     int opt;
 
-    while ((opt = getopt(argc, argv, ":p:n:h")) != -1)
+    while ((opt = getopt(argc, argv, ":p:n:u:i:c:d:e:U:Tl:Lj:P:W:r:q:k:D:S:Oh")) != -1)
     {
         switch (opt)
         {
@@ -44,7 +95,25 @@ int main(int argc, char* argv[])
             fprintf(stderr, "unknown option: %c\n", optopt);
         case 'h':
             fprintf(stdout, "-p for server port number\n"
-                            "-n for maximum number of clients\n");
+                            "-n for maximum number of clients\n"
+                            "-u for Unix-domain socket path of local members (shared memory capable)\n"
+                            "-i for cluster node ID (from 1)\n"
+                            "-c for cluster peers, e.g. 1@127.0.0.1:49153,2@127.0.0.1:49154\n"
+                            "-d for store-and-forward directory (offline members)\n"
+                            "-e for stored message expiry in seconds (default 3600)\n"
+                            "-U for hot restart socket path\n"
+                            "-T to take over from the server listening on the -U path\n"
+                            "-l for logger mode: thread, fork (default) or external\n"
+                            "-L to run as the standalone logger daemon used by -l external\n"
+                            "-j for binary journal file of routed messages (replay input)\n"
+                            "-P for priority classes by MTI, e.g. 0=800-899,1=100-199 (others are class 2)\n"
+                            "-W for weighted class flushing, e.g. 8,4,2,1 (strict priority by default)\n"
+                            "-r for request timeout in milliseconds, answered by the switch (default 0 = none)\n"
+                            "-q for pending message expiry in seconds (default 0 = never)\n"
+                            "-k for dropping members silent for that many seconds (default 0 = never)\n"
+                            "-D for dropping frames a member repeats within that many milliseconds (default 0 = off)\n"
+                            "-S for the time given to drain on shutdown in milliseconds (default 2000)\n"
+                            "-O to check that the requests of each member pair are routed in order\n");
             break;
         case 'p':
             port = atoi(optarg);
@@ -52,43 +121,210 @@ int main(int argc, char* argv[])
         case 'n':
             numConns = atoi(optarg);
             break;
+        case 'u':
+            unixPath = optarg;
+            break;
+        case 'i':
+            nodeId = atoi(optarg);
+            break;
+        case 'c':
+            if (!parsePeerList(optarg, peers))
+            {
+                fprintf(stderr, "invalid peer list: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            storeDir = optarg;
+            break;
+        case 'e':
+            storeTtl = atoi(optarg);
+            break;
+        case 'U':
+            handoffPath = optarg;
+            break;
+        case 'T':
+            takeover = true;
+            break;
+        case 'l':
+            if (!parseLogMode(optarg, logMode))
+            {
+                fprintf(stderr, "invalid logger mode: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'L':
+            runLogger = true;
+            break;
+        case 'j':
+            journalPath = optarg;
+            break;
+        case 'P':
+            laneClasses = optarg;
+            break;
+        case 'W':
+            laneWeights = optarg;
+            break;
+        case 'r':
+            requestTimeout = atoi(optarg);
+            break;
+        case 'q':
+            pendingTtl = atoi(optarg);
+            break;
+        case 'k':
+            idleTimeout = atoi(optarg);
+            break;
+        case 'D':
+            dedupWindow = atoi(optarg);
+            break;
+        case 'S':
+            shutdownDeadline = atoi(optarg);
+            break;
+        case 'O':
+            checkOrder = true;
+            break;
         case ':':
             fprintf(stderr, "option needs a value\n");
             break;
         }
     }
 
-    Message message;
-    //printf("sizeof message: %d\n", sizeof(isc_msg_t));
+    if (takeover && handoffPath.empty())
+    {
+        fprintf(stderr, "-T needs the -U path of the running server\n");
+        return 1;
+    }
+
+    if (journalPath != nullptr && logMode == LogMode::External && !runLogger)
+    {
+        fprintf(stderr, "-j is ignored, the logger daemon writes the journal\n");
+        journalPath = nullptr;
+    }
+
+    if (journalPath != nullptr)
+    {
+        journal = openJournal(journalPath);
+        if (journal == nullptr)
+        {
+            perror("journal");
+            return 1;
+        }
+    }
+
     std::unique_ptr<ServerBase> server = nullptr;
+    std::unique_ptr<LogChannel> channel = nullptr;
+    int queueId = -1;
     signal(SIGINT, sig_handler); // register signal handler
 
-    // split into 2 processes
-    pid = fork();
-    if (pid > 0) // parent process
+    if (runLogger) // standalone logger daemon
     {
-        server = make_unique_cpp11<Switch>(port, numConns);
+        queueId = msgget(logDaemonKey(), 0666 | IPC_CREAT);
+        if (queueId < 0)
+        {
+            perror("msgget() failed");
+            return 1;
+        }
+
+        server = make_unique_cpp11<Logger>(queueId, true, journal);
         server->run();
+        printf("Logger daemon is running...\n");
+        waitForServer(*server);
+        return 0;
     }
-    else if (pid == 0) // child process
+
+    switch (logMode)
     {
-        server = make_unique_cpp11<Logger>();
-        server->run();
+    case LogMode::Thread:
+        channel = make_unique_cpp11<ThreadLogChannel>(stdout, journal);
+        break;
+    case LogMode::Fork:
+        queueId = msgget(IPC_PRIVATE, 0600);
+        if (queueId < 0)
+        {
+            perror("msgget() failed");
+            return 1;
+        }
+
+        // split into 2 processes
+        pid = fork();
+        if (pid == 0) // child process
+        {
+            signal(SIGINT, SIG_IGN); // the Switch stops us after its last message
+            close(quitFd);           // shared with the Switch
+            quitFd = -1;
+#ifdef __linux__
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+            server = make_unique_cpp11<Logger>(queueId, false, journal);
+            server->run();
+            waitForServer(*server);
+            return 0;
+        }
+        else if (pid < 0) // error
+        {
+            perror("fork() failed");
+            msgctl(queueId, IPC_RMID, nullptr);
+            return 1;
+        }
+        if (journal != nullptr)
+            fclose(journal); // the Logger writes it
+        channel = make_unique_cpp11<QueueLogChannel>(queueId, true);
+        break;
+    case LogMode::External:
+        queueId = msgget(logDaemonKey(), 0);
+        if (queueId < 0)
+        {
+            fprintf(stderr, "no logger daemon is running, start one with -L\n");
+            return 1;
+        }
+        channel = make_unique_cpp11<QueueLogChannel>(queueId, false);
+        break;
     }
-    else // error
+
+    HandoffState state;
+    int predecessor = -1;
+    if (takeover)
     {
-        perror("fork() failed");
-        return 1;
+        predecessor = Handoff::receive(handoffPath, state);
+        if (predecessor < 0)
+        {
+            fprintf(stderr, "takeover from %s failed\n", handoffPath.c_str());
+            channel.reset();
+            stopLogger(queueId);
+            return 1;
+        }
+        server = make_unique_cpp11<Switch>(state, numConns);
     }
-
-    while (server->isRunning())
+    else
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        if (quit.load())
-            break; // exit normally after SIGINT
+        server = make_unique_cpp11<Switch>(port, numConns);
     }
 
-    if (pid > 0) // parent process
-        wait(nullptr);
+    Switch* sw = static_cast<Switch*>(server.get());
+    sw->setLogChannel(std::move(channel));
+    sw->setTimeouts(requestTimeout, pendingTtl * 1000, idleTimeout * 1000);
+    if (dedupWindow > 0)
+        sw->enableDedup(dedupWindow);
+    sw->setShutdownDeadline(shutdownDeadline);
+    if (checkOrder)
+        sw->enableOrderCheck();
+    if (nodeId > 0)
+        sw->enableCluster(nodeId, peers);
+    if (!storeDir.empty() && sw->enableStore(storeDir, storeTtl) != 0)
+        fprintf(stderr, "store-and-forward disabled, keeping pending messages in memory\n");
+    if ((!laneClasses.empty() || !laneWeights.empty()) && sw->enableLanes(laneClasses, laneWeights) != 0)
+        fprintf(stderr, "priority lanes disabled, every MTI is flushed in arrival order\n");
+    if (!unixPath.empty() && sw->enableUnixSocket(unixPath) != 0)
+        fprintf(stderr, "Unix-domain members disabled\n");
+    if (!handoffPath.empty() && sw->enableHandoff(handoffPath) != 0)
+        fprintf(stderr, "hot restart disabled\n");
+    if (predecessor > -1)
+        Handoff::acknowledge(predecessor); // the predecessor stops routing now
+    server->run();
+
+    waitForServer(*server);
+
+    server.reset(); // stop routing first, the Logger then drains what was routed
+    stopLogger(queueId);
     return 0;
 }
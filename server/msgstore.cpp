@@ -0,0 +1,307 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "msgstore.h"
+
+static uint64_t nowMillis()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+MessageStore::MessageStore(const std::string& dir, int ttlSeconds) : mDir(dir), mTtl((uint64_t) ttlSeconds * 1000)
+{
+}
+
+MessageStore::~MessageStore()
+{
+    for (auto& it : mLogs)
+    {
+        msync(it.second.base, it.second.capacity, MS_ASYNC);
+        munmap(it.second.base, it.second.capacity);
+        close(it.second.fd);
+    }
+}
+
+std::string MessageStore::logPath(int id) const
+{
+    return mDir + "/member_" + std::to_string(id) + ".log";
+}
+
+/**
+ * Creates the store directory and recovers the logs left by a
+ * previous run.
+ */
+int MessageStore::open()
+{
+    if (mkdir(mDir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        perror("  MessageStore: mkdir() failed");
+        return -1;
+    }
+
+    DIR* dir = opendir(mDir.c_str());
+    if (dir == nullptr)
+    {
+        perror("  MessageStore: opendir() failed");
+        return -1;
+    }
+
+    int recovered = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        int id;
+        if (sscanf(entry->d_name, "member_%d.log", &id) != 1)
+            continue;
+
+        StoreLog* log = getLog(id, false);
+        if (log == nullptr)
+            continue;
+
+        if (hasPending(id))
+            recovered++;
+        else
+            resetLog(*log);
+    }
+    closedir(dir);
+
+    fprintf(stdout, "  MessageStore: %d destination(s) recovered from %s\n", recovered, mDir.c_str());
+    return 0;
+}
+
+MessageStore::StoreLog* MessageStore::getLog(int id, bool create)
+{
+    auto it = mLogs.find(id);
+    if (it != mLogs.end())
+    {
+        mLru.splice(mLru.begin(), mLru, it->second.lru);
+        return &it->second;
+    }
+
+    if (mLogs.size() >= STORE_OPEN_LOGS)
+        closeLog(mLru.back());
+
+    int fd = ::open(logPath(id).c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    fstat(fd, &st);
+
+    StoreLog log = {fd, nullptr, 0, sizeof(store_header_t), mLru.end()};
+    size_t capacity = st.st_size < STORE_INITIAL_SIZE ? STORE_INITIAL_SIZE : st.st_size;
+    if (mapLog(log, capacity) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    if (header(log)->magic != STORE_MAGIC)
+    {
+        header(log)->magic = STORE_MAGIC;
+        header(log)->head = sizeof(store_header_t);
+    }
+    else
+    {
+        /**********************************************/
+        /* The tail is the first uncommitted record.  */
+        /**********************************************/
+        size_t offset = header(log)->head;
+        while (offset + sizeof(store_record_t) <= log.capacity &&
+               ((store_record_t*) (log.base + offset))->magic == STORE_MAGIC)
+            offset += sizeof(store_record_t);
+        log.tail = offset;
+    }
+
+    mParked.erase(id);
+    mLru.push_front(id);
+    log.lru = mLru.begin();
+    return &mLogs.emplace(id, log).first->second;
+}
+
+/**
+ * Unmaps and closes a log. One without frames is removed, the others
+ * wait on disk until their member shows up.
+ */
+void MessageStore::closeLog(int id)
+{
+    auto it = mLogs.find(id);
+    if (it == mLogs.end())
+        return;
+
+    StoreLog& log = it->second;
+    bool pending = header(log)->head < log.tail;
+    uint64_t newest = pending ? ((store_record_t*) (log.base + log.tail) - 1)->timestamp : 0;
+    msync(log.base, log.capacity, MS_ASYNC);
+    munmap(log.base, log.capacity);
+    close(log.fd);
+
+    if (pending)
+        mParked[id] = newest;
+    else
+        unlink(logPath(id).c_str());
+    mLru.erase(log.lru);
+    mLogs.erase(it);
+}
+
+/**
+ * Grows the file to capacity and (re)maps it.
+ */
+int MessageStore::mapLog(StoreLog& log, size_t capacity)
+{
+    if (ftruncate(log.fd, capacity) != 0)
+    {
+        perror("  MessageStore: ftruncate() failed");
+        return -1;
+    }
+
+    void* base;
+    if (log.base == nullptr)
+        base = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, log.fd, 0);
+    else
+        base = mremap(log.base, log.capacity, capacity, MREMAP_MAYMOVE);
+
+    if (base == MAP_FAILED)
+    {
+        perror("  MessageStore: mmap() failed");
+        return -1;
+    }
+
+    log.base = (uint8_t*) base;
+    log.capacity = capacity;
+    return 0;
+}
+
+/**
+ * Rewinds a drained log. Truncating the file zeroes the old records and
+ * gives their pages back, so an idle destination costs one small mapping.
+ */
+void MessageStore::resetLog(StoreLog& log)
+{
+    header(log)->head = sizeof(store_header_t);
+    log.tail = sizeof(store_header_t);
+
+    if (ftruncate(log.fd, sizeof(store_header_t)) != 0 || mapLog(log, STORE_INITIAL_SIZE) != 0)
+        perror("  MessageStore: failed to shrink log");
+}
+
+bool MessageStore::append(Message& message)
+{
+    StoreLog* log = getLog(message.getDstId(), true);
+    if (log == nullptr)
+        return false;
+
+    if (log->tail + sizeof(store_record_t) > log->capacity && mapLog(*log, log->capacity * 2) != 0)
+        return false;
+
+    store_record_t* record = (store_record_t*) (log->base + log->tail);
+    record->timestamp = nowMillis();
+    memcpy(&record->frame, message.getData(), sizeof(record->frame));
+    __atomic_store_n(&record->magic, STORE_MAGIC, __ATOMIC_RELEASE);
+
+    log->tail += sizeof(store_record_t);
+    return true;
+}
+
+bool MessageStore::hasPending(int id) const
+{
+    auto it = mLogs.find(id);
+    if (it == mLogs.end())
+        return mParked.count(id) != 0;
+
+    return ((store_header_t*) it->second.base)->head < it->second.tail;
+}
+
+int MessageStore::replay(int id, const BatchSender& sender)
+{
+    if (!hasPending(id))
+        return 0;
+
+    StoreLog* found = getLog(id, false);
+    if (found == nullptr)
+    {
+        mParked.erase(id); // removed behind our back
+        return 0;
+    }
+
+    StoreLog& log = *found;
+    uint64_t deadline = nowMillis() - mTtl;
+    uint8_t batch[STORE_REPLAY_BATCH * sizeof(isc_msg_t)];
+    int total = 0;
+
+    size_t ends[STORE_REPLAY_BATCH]; // offset after the record of each frame in batch
+
+    size_t offset = header(log)->head;
+    while (offset < log.tail)
+    {
+        size_t start = offset;
+        int count = 0;
+        while (offset < log.tail && count < STORE_REPLAY_BATCH)
+        {
+            store_record_t* record = (store_record_t*) (log.base + offset);
+            offset += sizeof(store_record_t);
+            if (record->timestamp < deadline)
+                continue; // expired
+
+            memcpy(batch + count * sizeof(isc_msg_t), &record->frame, sizeof(isc_msg_t));
+            ends[count++] = offset;
+        }
+
+        int sent = count > 0 ? sender(batch, count * sizeof(isc_msg_t), count) : 0;
+        if (sent < 0)
+            return -1; // keep the head at the last delivered batch
+
+        if (sent < count)
+        {
+            header(log)->head = sent > 0 ? ends[sent - 1] : start;
+            return total + sent; // the rest waits until the member took these
+        }
+        header(log)->head = offset;
+        total += count;
+    }
+
+    resetLog(log);
+    return total;
+}
+
+void MessageStore::expire()
+{
+    uint64_t deadline = nowMillis() - mTtl;
+
+    for (auto& it : mLogs)
+    {
+        StoreLog& log = it.second;
+        size_t offset = header(log)->head;
+        while (offset < log.tail && ((store_record_t*) (log.base + offset))->timestamp < deadline)
+            offset += sizeof(store_record_t);
+
+        if (offset == log.tail)
+        {
+            if (header(log)->head != log.tail)
+                resetLog(log);
+        }
+        else
+        {
+            header(log)->head = offset;
+        }
+    }
+
+    for (auto it = mParked.begin(); it != mParked.end();)
+    {
+        if (it->second >= deadline)
+        {
+            it++;
+            continue;
+        }
+        unlink(logPath(it->first).c_str()); // nothing left worth a replay
+        it = mParked.erase(it);
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef MSGSTORE_H
+#define MSGSTORE_H
+
+#include <string>
+#include <list>
+#include <functional>
+#include <unordered_map>
+#include "isc_msg.h"
+
+#define STORE_MAGIC 0x15C5704E
+#define STORE_INITIAL_SIZE (64 * 1024)  /* bytes mapped when a log is created */
+#define STORE_REPLAY_BATCH 64           /* frames sent per replay batch       */
+#define STORE_OPEN_LOGS 256             /* logs kept mapped at the same time  */
+
+// header at the start of every destination log
+typedef struct
+{
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t head; // offset of the first record not yet delivered
+} store_header_t;
+
+// one stored frame, the magic is written last to commit the record
+typedef struct
+{
+    uint64_t timestamp; // milliseconds since epoch
+    uint32_t magic;
+    isc_msg_t frame;
+} store_record_t;
+
+/**
+ * Spill-to-disk store-and-forward queue for offline destinations.
+ *
+ * Every destination owns an append-only log file mapped with mmap().
+ * Only the head and tail offsets of each log are kept on the heap, so
+ * memory stays flat no matter how long a member is away. At most
+ * STORE_OPEN_LOGS logs stay mapped: the least recently used one is
+ * closed, and removed if it holds no frames. Logs found in the directory
+ * on open() are recovered, so queued frames survive a restart.
+ */
+class MessageStore
+{
+  public:
+    // returns the number of frames taken, -1 if the member is gone
+    using BatchSender = std::function<int(const uint8_t* data, size_t size, int count)>;
+
+    MessageStore(const std::string& dir, int ttlSeconds);
+    ~MessageStore();
+
+    int open();
+
+    /**
+     * Appends a frame to the log of its destination.
+     * @return false if the frame could not be stored
+     */
+    bool append(Message& message);
+
+    bool hasPending(int id) const;
+
+    /**
+     * Replays the frames stored for a member, oldest first, in batches of
+     * up to STORE_REPLAY_BATCH frames. Expired frames are skipped. When the
+     * sender takes only part of a batch the rest stays stored, see
+     * hasPending().
+     * @return the number of frames sent, or -1 if sender failed
+     */
+    int replay(int id, const BatchSender& sender);
+
+    /**
+     * Drops the frames older than the TTL from the head of every log, and
+     * removes the closed logs whose newest frame is older.
+     */
+    void expire();
+
+  private:
+    struct StoreLog
+    {
+        int fd;
+        uint8_t* base;
+        size_t capacity;
+        size_t tail;
+        std::list<int>::iterator lru;
+    };
+
+    StoreLog* getLog(int id, bool create);
+    void closeLog(int id);
+    int mapLog(StoreLog& log, size_t capacity);
+    void resetLog(StoreLog& log);
+    std::string logPath(int id) const;
+
+    store_header_t* header(StoreLog& log)
+    {
+        return (store_header_t*) log.base;
+    }
+
+    std::string mDir;
+    uint64_t mTtl; // milliseconds
+    std::unordered_map<int, StoreLog> mLogs{}; // member id --> log
+    std::list<int> mLru{};                     // mapped logs, most recently used first
+    std::unordered_map<int, uint64_t> mParked{}; // closed logs still holding frames --> newest timestamp
+};
+
+#endif // MSGSTORE_H
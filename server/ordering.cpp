@@ -0,0 +1,26 @@
+#include "ordering.h"
+
+void OrderMonitor::check(const isc_msg_t& frame, bool ingress)
+{
+    if (frame.trace[0] != 0 || !hasSequence(frame))
+        return;
+
+    uint64_t src = frame.src_id[0] | (frame.src_id[1] << 8) | (frame.src_id[2] << 16);
+    uint64_t dst = frame.dst_id[0] | (frame.dst_id[1] << 8) | (frame.dst_id[2] << 16);
+    PairState& pair = mPairs[src << 24 | dst];
+    if (ingress)
+        seqCheck(pair.ingress, getSequence(frame), mIngress);
+    else
+        seqCheck(pair.egress, getSequence(frame), mEgress);
+}
+
+void OrderMonitor::report(FILE* file) const
+{
+    const char* names[] = {"ingress", "egress"};
+    const seq_counters_t* counters[] = {&mIngress, &mEgress};
+    for (int i = 0; i < 2; i++)
+    {
+        fprintf(file, "  Server: %s %lu request(s) in order, %lu gap(s) (%lu missing), %lu reordered\n", names[i],
+                counters[i]->inOrder, counters[i]->gaps, counters[i]->missing, counters[i]->reordered);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef ORDERING_H
+#define ORDERING_H
+
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include "isc_msg.h"
+#include "isc_seq.h"
+
+/**
+ * Sidecar table of the request sequences of every (src, dst) pair, kept
+ * where a frame enters the switch and where it leaves it for a local
+ * member. Ingress counters tell what the members sent, egress counters
+ * what the routing path made of it: a reordering or gap found at egress
+ * only was made by the switch.
+ *
+ * Replies and frames without a sequence are not checked. Priority lanes
+ * legitimately reorder the requests of a pair whose MTIs fall into
+ * different classes.
+ */
+class OrderMonitor
+{
+  public:
+    void onIngress(const isc_msg_t& frame)
+    {
+        check(frame, true);
+    }
+    void onEgress(const isc_msg_t& frame)
+    {
+        check(frame, false);
+    }
+
+    const seq_counters_t& getIngress() const
+    {
+        return mIngress;
+    }
+    const seq_counters_t& getEgress() const
+    {
+        return mEgress;
+    }
+
+    void report(FILE* file) const;
+
+  private:
+    struct PairState
+    {
+        seq_state_t ingress;
+        seq_state_t egress;
+    };
+
+    void check(const isc_msg_t& frame, bool ingress);
+
+    std::unordered_map<uint64_t, PairState> mPairs{}; // src << 24 | dst --> sequences
+    seq_counters_t mIngress{};
+    seq_counters_t mEgress{};
+};
+
+#endif // ORDERING_H
@@ -0,0 +1,169 @@
+#include <thread>
+#include "registry.h"
+
+EpochDomain::EpochDomain() : mEpoch(1)
+{
+    for (auto& slot : mSlots)
+        slot.epoch.store(0, std::memory_order_relaxed);
+}
+
+EpochDomain::~EpochDomain()
+{
+    // no reader is left, everything can go
+    for (auto& retired : mRetired)
+        retired.deleter();
+}
+
+EpochDomain::Guard::Guard(EpochDomain& domain) : mSlot(nullptr)
+{
+    static std::atomic<unsigned> nextHint{0};
+    static thread_local unsigned hint = nextHint++;
+
+    /**********************************************/
+    /* Every thread starts from a slot of its     */
+    /* own, so the first try practically always   */
+    /* succeeds.                                  */
+    /**********************************************/
+    for (unsigned i = 0; mSlot == nullptr; i++)
+    {
+        std::atomic<uint64_t>& slot = domain.mSlots[(hint + i) % EPOCH_SLOTS].epoch;
+        uint64_t idle = 0;
+
+        // the announcement must be visible before the table is read
+        if (slot.compare_exchange_strong(idle, domain.mEpoch.load(std::memory_order_seq_cst),
+                                         std::memory_order_seq_cst))
+            mSlot = &slot;
+        else if (i % EPOCH_SLOTS == EPOCH_SLOTS - 1)
+            std::this_thread::yield(); // more readers than slots
+    }
+}
+
+EpochDomain::Guard::~Guard()
+{
+    mSlot->store(0, std::memory_order_release);
+}
+
+void EpochDomain::retire(std::function<void()> deleter)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mRetired.push_back(Retired{mEpoch.fetch_add(1, std::memory_order_seq_cst), std::move(deleter)});
+    mRetiredCount.store(mRetired.size(), std::memory_order_relaxed);
+}
+
+size_t EpochDomain::reclaim()
+{
+    if (mRetiredCount.load(std::memory_order_relaxed) == 0)
+        return 0;
+
+    /**********************************************/
+    /* A reader that announced an epoch after an  */
+    /* object was retired cannot have found it.   */
+    /**********************************************/
+    uint64_t oldest = UINT64_MAX;
+    for (auto& slot : mSlots)
+    {
+        uint64_t epoch = slot.epoch.load(std::memory_order_seq_cst);
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    std::vector<Retired> freed;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mRetired.begin();
+        while (it != mRetired.end())
+        {
+            if (it->epoch < oldest)
+            {
+                freed.push_back(std::move(*it));
+                it = mRetired.erase(it);
+            }
+            else
+            {
+                it++;
+            }
+        }
+        mRetiredCount.store(mRetired.size(), std::memory_order_relaxed);
+    }
+
+    // deleters may close descriptors, keep them out of the lock
+    for (auto& retired : freed)
+        retired.deleter();
+    return freed.size();
+}
+
+MemberRegistry::MemberRegistry()
+{
+    for (auto& page : mPages)
+        page.store(nullptr, std::memory_order_relaxed);
+}
+
+MemberRegistry::~MemberRegistry()
+{
+    for (auto& page : mPages)
+        delete page.load(std::memory_order_relaxed);
+}
+
+MemberRegistry::Page* MemberRegistry::getPage(int id)
+{
+    std::atomic<Page*>& entry = mPages[id >> REGISTRY_PAGE_BITS];
+    Page* page = entry.load(std::memory_order_acquire);
+    if (page != nullptr)
+        return page;
+
+    Page* created = new Page;
+    for (auto& slot : created->entries)
+        slot.store(nullptr, std::memory_order_relaxed);
+
+    // another writer may have been first
+    if (entry.compare_exchange_strong(page, created, std::memory_order_acq_rel))
+        return created;
+    delete created;
+    return page;
+}
+
+bool MemberRegistry::add(int id, Connection* connection)
+{
+    if ((unsigned) id >= (1u << REGISTRY_ID_BITS) || connection == nullptr)
+        return false;
+
+    Connection* empty = nullptr;
+    std::atomic<Connection*>& entry = getPage(id)->entries[id & (REGISTRY_PAGE_SIZE - 1)];
+    if (!entry.compare_exchange_strong(empty, connection, std::memory_order_seq_cst))
+        return false;
+
+    mSize.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+Connection* MemberRegistry::remove(int id)
+{
+    if ((unsigned) id >= (1u << REGISTRY_ID_BITS))
+        return nullptr;
+
+    Page* page = mPages[id >> REGISTRY_PAGE_BITS].load(std::memory_order_acquire);
+    if (page == nullptr)
+        return nullptr;
+
+    Connection* connection = page->entries[id & (REGISTRY_PAGE_SIZE - 1)].exchange(nullptr, std::memory_order_seq_cst);
+    if (connection != nullptr)
+        mSize.fetch_sub(1, std::memory_order_relaxed);
+    return connection;
+}
+
+void MemberRegistry::forEach(const std::function<void(int, Connection*)>& visit) const
+{
+    for (int p = 0; p < REGISTRY_PAGES; p++)
+    {
+        Page* page = mPages[p].load(std::memory_order_acquire);
+        if (page == nullptr)
+            continue;
+
+        for (int i = 0; i < REGISTRY_PAGE_SIZE; i++)
+        {
+            Connection* connection = page->entries[i].load(std::memory_order_acquire);
+            if (connection != nullptr)
+                visit((p << REGISTRY_PAGE_BITS) | i, connection);
+        }
+    }
+}
@@ -0,0 +1,145 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "connection.h"
+
+#define EPOCH_SLOTS 64          /* threads that can be inside a guard at once */
+#define REGISTRY_ID_BITS 24     /* member ids are 3 bytes on the wire         */
+#define REGISTRY_PAGE_BITS 12
+#define REGISTRY_PAGE_SIZE (1 << REGISTRY_PAGE_BITS)
+#define REGISTRY_PAGES (1 << (REGISTRY_ID_BITS - REGISTRY_PAGE_BITS))
+
+/**
+ * Epoch-based reclamation.
+ *
+ * A reader announces the global epoch in a slot of its own for as long as
+ * a Guard lives. Writers unpublish an object first and retire it with the
+ * epoch of the moment; reclaim() frees it once every announced epoch is
+ * newer, that is once no reader can still hold it. Readers never wait on
+ * writers.
+ */
+class EpochDomain
+{
+  public:
+    class Guard
+    {
+      public:
+        explicit Guard(EpochDomain& domain);
+        ~Guard();
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+      private:
+        std::atomic<uint64_t>* mSlot;
+    };
+
+    EpochDomain();
+    ~EpochDomain();
+
+    /**
+     * Runs deleter once no Guard entered before now is alive.
+     */
+    void retire(std::function<void()> deleter);
+
+    /**
+     * Runs the deleters of the objects no reader can reach anymore.
+     * @return the number of objects freed
+     */
+    size_t reclaim();
+
+  private:
+    struct alignas(64) EpochSlot
+    {
+        std::atomic<uint64_t> epoch; // 0 when the owner is outside any guard
+    };
+
+    struct Retired
+    {
+        uint64_t epoch;
+        std::function<void()> deleter;
+    };
+
+    std::atomic<uint64_t> mEpoch;
+    EpochSlot mSlots[EPOCH_SLOTS];
+
+    std::mutex mMutex{};                  // guards mRetired
+    std::vector<Retired> mRetired{};
+    std::atomic<size_t> mRetiredCount{0}; // lets reclaim() skip the lock
+};
+
+/**
+ * Member id --> connection table shared by the routing threads.
+ *
+ * Ids index a two-level table of atomic pointers, so a lookup is two
+ * loads and never waits. Pages are created on first use and kept until
+ * the registry goes away. A connection found with find() stays valid
+ * while the caller holds a Guard of getDomain(); whoever removes it
+ * retires it there instead of deleting it.
+ */
+class MemberRegistry
+{
+  public:
+    MemberRegistry();
+    ~MemberRegistry();
+
+    /**
+     * @return false if the id is out of range or already taken
+     */
+    bool add(int id, Connection* connection);
+
+    /**
+     * @return the connection of the member, or nullptr. Call it within a Guard.
+     */
+    Connection* find(int id) const
+    {
+        if ((unsigned) id >= (1u << REGISTRY_ID_BITS))
+            return nullptr;
+
+        Page* page = mPages[id >> REGISTRY_PAGE_BITS].load(std::memory_order_acquire);
+        if (page == nullptr)
+            return nullptr;
+        return page->entries[id & (REGISTRY_PAGE_SIZE - 1)].load(std::memory_order_seq_cst);
+    }
+
+    /**
+     * Unpublishes a member. The caller retires the connection returned.
+     * @return the connection the member had, or nullptr
+     */
+    Connection* remove(int id);
+
+    size_t size() const
+    {
+        return mSize.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Visits every registered member, for the rare paths that need all of
+     * them (handoff, cluster snapshots).
+     */
+    void forEach(const std::function<void(int, Connection*)>& visit) const;
+
+    EpochDomain& getDomain()
+    {
+        return mDomain;
+    }
+
+  private:
+    struct Page
+    {
+        std::atomic<Connection*> entries[REGISTRY_PAGE_SIZE];
+    };
+
+    Page* getPage(int id);
+
+    std::atomic<Page*> mPages[REGISTRY_PAGES];
+    std::atomic<size_t> mSize{0};
+    EpochDomain mDomain;
+};
+
+#endif // REGISTRY_H
@@ -1,11 +1,20 @@
 #include <cstdio>
 #include <cstring>
 #include <cerrno>
+#include <algorithm>
 #include <sys/types.h>
 #include <sys/select.h>
 #include <sys/ioctl.h>
 #include <sys/poll.h>
+#include <sys/un.h>
+#include <sys/mman.h>
 #include "server.h"
+#include "decoder.h"
+
+static int memberId(const uint8_t* id)
+{
+    return id[0] + (id[1] << 8) + (id[2] << 16);
+}
 
 int ServerBase::receiveMessage(int fd, char* buffer, size_t size, int timeout)
 {
@@ -36,10 +45,56 @@ int ServerBase::receiveMessage(int fd, char* buffer, size_t size, int timeout)
     }
 }
 
+Switch::Switch(HandoffState& state, int maxClients) : ServerBase(-1, maxClients)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    mListenSocket = state.listenSocket;
+    mUnixListenSocket = state.unixListenSocket;
+    if (getsockname(mListenSocket, (struct sockaddr*) &addr, &len) == 0)
+        mPort = ntohs(addr.sin_port);
+
+    for (size_t i = 0; i < state.sockets.size(); i++)
+    {
+        int sd = state.sockets[i];
+        mSdQueue.emplace_back(sd);
+
+        auto connection = make_unique_cpp11<SocketConnection>(sd, state.wireStates[i], state.inputs[i]);
+        if (state.memberIds[i] > -1 && mRegistry.add(state.memberIds[i], connection.get()))
+            connection->setMemberId(state.memberIds[i]);
+        mConnections.emplace(sd, std::move(connection));
+        readAgain(sd); // input may be buffered already
+
+        /**********************************************/
+        /* What the predecessor routed to the member  */
+        /* and did not write goes out first.          */
+        /**********************************************/
+        const std::string& unsent = state.unsent[i];
+        if (!unsent.empty())
+        {
+            std::vector<FrameRef> frames;
+            for (size_t offset = 0; offset < unsent.size(); offset += sizeof(isc_msg_t))
+                frames.push_back(mFramePool.copy(unsent.data() + offset));
+            if ((size_t) sd >= mLanes.size())
+                mLanes.resize(sd + 1);
+            mLanes[sd].keepUnsent(frames, 0, state.unsentOffsets[i]);
+            mBlockedSockets.push_back(sd);
+        }
+    }
+    for (auto& message : state.pending)
+        queuePending(*(isc_msg_t*) message.getData());
+
+    fprintf(stdout, "  Server: took over port %d with %lu connection(s), %lu member(s), %lu pending message(s)\n",
+            mPort, mSdQueue.size(), mRegistry.size(), mPendingMsgQueue.size());
+}
+
 int Switch::init()
 {
     if (mListenSocket > -1)
         return 1;
+    if (mPort < 0)
+        return 0; // members come through addConnection() only
 
     int rc;
     int on = 1;
@@ -116,118 +171,387 @@ void Switch::run()
     mAcceptHandler = make_unique_cpp11<std::thread>([&]() { acceptHandler(); });
     mConnectionHandler = make_unique_cpp11<std::thread>([&]() { connectionHandler(); });
 
+    if (mCluster != nullptr)
+    {
+        mCluster->start(
+            [&](int fd) {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mSdQueue.emplace_back(fd);
+                wakeRouting();
+            },
+            mStopFd);
+    }
+
     printf("Server is running...\n");
 }
 
+void Switch::enableCluster(int nodeId, const std::vector<PeerAddress>& peers)
+{
+    mCluster = make_unique_cpp11<Cluster>(nodeId, peers);
+    printf("Switch node (%d) with %lu peer(s)\n", nodeId, peers.size());
+}
+
+int Switch::enableStore(const std::string& dir, int ttlSeconds)
+{
+    mStore = make_unique_cpp11<MessageStore>(dir, ttlSeconds);
+    if (mStore->open() != 0)
+    {
+        mStore.reset();
+        return -1;
+    }
+    return 0;
+}
+
+int Switch::enableHandoff(const std::string& path)
+{
+    mHandoff = make_unique_cpp11<Handoff>();
+    if (mHandoff->listen(path) != 0)
+    {
+        mHandoff.reset();
+        return -1;
+    }
+    return 0;
+}
+
+int Switch::enableLanes(const std::string& classes, const std::string& weights)
+{
+    LaneScheduler scheduler;
+    if (!scheduler.parseClasses(classes))
+    {
+        fprintf(stderr, "  Server: invalid priority classes: %s\n", classes.c_str());
+        return -1;
+    }
+    if (!weights.empty() && !scheduler.parseWeights(weights))
+    {
+        fprintf(stderr, "  Server: invalid lane weights: %s\n", weights.c_str());
+        return -1;
+    }
+
+    mScheduler = scheduler;
+    return 0;
+}
+
+void Switch::enableDedup(int windowMs)
+{
+    mDedup = make_unique_cpp11<DedupCache>(windowMs);
+}
+
+void Switch::enableOrderCheck()
+{
+    mOrder = make_unique_cpp11<OrderMonitor>();
+}
+
+void Switch::setTimeouts(int requestMs, int pendingMs, int idleMs)
+{
+    mRequestTimeout = requestMs;
+    mPendingTimeout = pendingMs;
+    mIdleTimeout = idleMs;
+
+    // messages taken over from a predecessor get the new TTL
+    for (auto& it : mPendingMsgQueue)
+    {
+        mTimers.cancel(it.second.timer);
+        it.second.timer = mPendingTimeout > 0 ? mTimers.add(mNow + mPendingTimeout, PendingTimer, it.first) : 0;
+    }
+}
+
+int Switch::enableUnixSocket(const std::string& path)
+{
+    mUnixPath = path;
+    if (mUnixListenSocket > -1)
+        return 0; // taken over from the predecessor
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "  Server: Unix socket path too long: %s\n", path.c_str());
+        return -1;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    mUnixListenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (mUnixListenSocket < 0)
+    {
+        perror("socket() failed");
+        return -1;
+    }
+
+    unlink(path.c_str()); // left behind by a process that did not shut down
+    if (bind(mUnixListenSocket, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+        listen(mUnixListenSocket, mMaxConns) < 0)
+    {
+        perror("bind() failed");
+        close(mUnixListenSocket);
+        mUnixListenSocket = -1;
+        return -1;
+    }
+    return 0;
+}
+
 void Switch::acceptHandler()
 {
     int newSd;
+    struct pollfd pfds[3];
+    int count = 0;
+
+    for (int listenSocket : {mListenSocket, mUnixListenSocket})
+    {
+        if (listenSocket > -1)
+            pfds[count++] = {listenSocket, POLLIN, 0};
+    }
+    pfds[count++] = {mStopFd, POLLIN, 0};
 
     /*************************************************************/
-    /* Loop waiting for incoming clients or for incoming data    */
-    /* on any of the connected sockets.                          */
+    /* Loop waiting for incoming clients, or for the stop.       */
     /*************************************************************/
     while (mRunning)
     {
-        newSd = accept(mListenSocket, nullptr, nullptr);
-        if (newSd < 0)
+        if (poll(pfds, count, -1) < 0 && errno != EINTR)
         {
-            if (errno != EWOULDBLOCK && errno != EAGAIN)
-            {
-                fprintf(stderr, "  Server: new connection (%lu) failed to be accepted\n", mSdQueue.size() + 1);
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            perror("  poll() failed");
+            break;
         }
-        else
+
+        for (int i = 0; i < count - 1; i++)
         {
-            fprintf(stdout, "  Server: new connection (%lu) accepted\n", mSdQueue.size() + 1);
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+
+            // handOff() stops us under the lock, connections then wait in the backlog for the successor
             std::lock_guard<std::mutex> lock(mMutex);
+            if (!mAccepting)
+                continue;
+
+            // never blocks the routing thread on a member that does not read
+            newSd = accept4(pfds[i].fd, nullptr, nullptr, SOCK_NONBLOCK);
+            if (newSd < 0)
+            {
+                if (errno != EWOULDBLOCK && errno != EAGAIN)
+                {
+                    fprintf(stderr, "  Server: new connection (%lu) failed to be accepted\n", mSdQueue.size() + 1);
+                }
+                continue;
+            }
+
+            fprintf(stdout, "  Server: new connection (%lu) accepted\n", mSdQueue.size() + 1);
             mSdQueue.emplace_back(newSd);
+            wakeRouting(); // poll it from now on, not after the next timeout
         }
+
+        if (!mAccepting)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1)); // until the handoff is over
     }
 }
 
-void Switch::connectionHandler()
+/**
+ * Interrupts the poll() of the connection thread so that it picks up
+ * the sockets added to mSdQueue.
+ */
+void Switch::wakeRouting()
 {
-    ipc_msg_t ipcMsg;
-    int rc;
-    int nfds;
+    uint64_t one = 1;
+    if (write(mWakeFd, &one, sizeof(one)) < 0)
+        perror("  eventfd write() failed");
+}
 
+void Switch::connectionHandler()
+{
     /*************************************************************/
     /* Loop waiting for incoming messages from already-connected */
     /* sockets.                                                  */
     /*************************************************************/
-    while (mRunning)
+    while (mRunning && step(-1))
+        ;
+
+    shutDown();
+}
+
+bool Switch::step(int timeoutMs)
+{
+    if (!mRunning)
+        return false;
+
+    /**********************************************************/
+    /* Drop stored messages that outlived their TTL and give  */
+    /* back the slabs of a burst.                             */
+    /**********************************************************/
+    if (std::chrono::steady_clock::now() - mLastSweep > std::chrono::seconds(1))
     {
-        std::deque<int> tempSdQueue;
-        {
-            std::lock_guard<std::mutex> lock(mMutex);
-            tempSdQueue = mSdQueue;
-            nfds = mSdQueue.size();
-        }
+        if (mStore != nullptr)
+            mStore->expire();
+        mFramePool.trim();
+        mLastSweep = std::chrono::steady_clock::now();
+    }
 
-        if (nfds == 0)
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            continue;
-        }
+    /**********************************************************/
+    /* Free the connections no sender can still be using.     */
+    /**********************************************************/
+    mRegistry.getDomain().reclaim();
 
-        /**********************************************************/
-        /* Call poll() and wait for it to timeout.                */
-        /**********************************************************/
-        struct pollfd pfds[nfds];
+    if (mDedup != nullptr)
+        mDedup->sweep(mNow);
 
-        int count = 0;
-        for (auto it : tempSdQueue)
-        {
-            pfds[count].fd = it;
-            pfds[count].events = POLLIN;
-            count++;
-        }
-        rc = poll(pfds, nfds, TIMEOUT);
+    int nfds;
+    std::deque<int> tempSdQueue;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        tempSdQueue = mSdQueue;
+        nfds = mSdQueue.size();
+    }
+    if (mCluster != nullptr)
+        mCluster->adoptDialed(); // before their first frame is read
 
-        /**********************************************************/
-        /* Check to see if the call failed.                       */
-        /**********************************************************/
-        if (rc < 0)
-        {
-            perror("  poll() failed");
-            break;
-        }
+    /**********************************************************/
+    /* Call poll() and wait for it to timeout.                */
+    /**********************************************************/
+    struct pollfd pfds[nfds + 3];
 
-        /**********************************************************/
-        /* Check to see if the timeout expired.                   */
-        /**********************************************************/
-        if (rc == 0)
-        {
-            // fprintf(stderr, "  poll() timed out.\n");
+    // no slab left to read into, until the lanes or the Logger release some
+    bool starved = mFramePool.isFull();
+
+    int count = 0;
+    for (auto it : tempSdQueue)
+    {
+        pfds[count].fd = it;
+        pfds[count].events = starved || (!mPaused.empty() && isPaused(it)) ? 0 : POLLIN;
+        if ((size_t) it < mLanes.size() && mLanes[it].isBlocked())
+            pfds[count].events |= getConnection(it).getWritableEvents();
+        else if (mCluster != nullptr && mCluster->hasOutput(it))
+            pfds[count].events |= POLLOUT;
+        count++;
+
+        if (mIdleTimeout > 0)
+            watchIdle(it);
+    }
+
+    /**********************************************************/
+    /* A successor process may ask for our sockets, new       */
+    /* sockets may be added and we may be told to stop.       */
+    /**********************************************************/
+    int handoffIndex = -1;
+    if (mHandoff != nullptr)
+    {
+        handoffIndex = count;
+        pfds[count++] = {mHandoff->getSocket(), POLLIN, 0};
+    }
+    int wakeIndex = count;
+    pfds[count++] = {mWakeFd, POLLIN, 0};
+    pfds[count++] = {mStopFd, POLLIN, 0};
+    if (timeoutMs < 0)
+        timeoutMs = mTimers.size() > 0 ? TIMER_POLL_TIMEOUT : TIMEOUT;
+    if (starved)
+        timeoutMs = std::min(timeoutMs, TIMER_POLL_TIMEOUT); // the Logger releases slabs without a wakeup
+    else if (mReadAgainCount > 0)
+        timeoutMs = 0; // input is waiting already
+    int rc = poll(pfds, count, timeoutMs);
+    mNow = steadyMillis();
+
+    /**********************************************************/
+    /* Check to see if the call failed.                       */
+    /**********************************************************/
+    if (rc < 0)
+    {
+        if (errno == EINTR)
+            return true;
+        perror("  poll() failed");
+        return false;
+    }
+
+    /**********************************************************/
+    /* Check to see if the timeout expired.                   */
+    /**********************************************************/
+    if (rc == 0 && (mReadAgainCount == 0 || starved))
+    {
+        // fprintf(stderr, "  poll() timed out.\n");
+        mTimers.advance(mNow, [&](int kind, uint64_t data) { onTimer(kind, data); });
+        flushLanes(); // timeout replies
+        flushCluster();
+        return true;
+    }
+
+    if (handoffIndex > -1 && (pfds[handoffIndex].revents & POLLIN) && handOff())
+        return false;
+
+    if (pfds[wakeIndex].revents & POLLIN)
+    {
+        uint64_t value;
+        if (read(mWakeFd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            perror("  eventfd read() failed");
+    }
+
+    /**********************************************************/
+    /* One or more descriptors are readable.  Need to         */
+    /* determine which ones they are.                         */
+    /**********************************************************/
+    for (int i = 0; i < nfds && !starved; i++)
+    {
+        /**********************************************/
+        /* There is data on this socket, or there may */
+        /* be more than its last batch took.          */
+        /**********************************************/
+        int fd = pfds[i].fd;
+        bool again = takeReadAgain(fd);
+        if (!(pfds[i].revents & POLLIN) && !again)
+            continue;
+        if (fd == mListenSocket)
             continue;
-        }
 
-        /**********************************************************/
-        /* One or more descriptors are readable.  Need to         */
-        /* determine which ones they are.                         */
-        /**********************************************************/
-        for (int i = 0; i < nfds; i++)
-        {
-            if (!(pfds[i].revents & POLLIN))
-                continue;
+        /**********************************************/
+        /* Check for new messages                     */
+        /**********************************************/
+        messageHandler(fd);
+    } // loop through selectable descriptors
 
-            /**********************************************/
-            /* There is data on this socket               */
-            /**********************************************/
-            int fd = pfds[i].fd;
-            if (fd == mListenSocket)
-                continue;
+    /**********************************************************/
+    /* Fire the timers due while we were waiting, after the   */
+    /* input: a member heard from this round is not reaped as */
+    /* idle, and a reply that just came in stops its timer.   */
+    /**********************************************************/
+    mTimers.advance(mNow, [&](int kind, uint64_t data) { onTimer(kind, data); });
 
-            /**********************************************/
-            /* Check for new messages                     */
-            /**********************************************/
-            messageHandler(fd);
-        } // loop through selectable descriptors
-    }     // while is mRunning
+    /**********************************************************/
+    /* Write what this round routed to local members, then    */
+    /* the frames batched for other switch nodes.             */
+    /**********************************************************/
+    resumeReplays();
+    flushLanes();
+    flushCluster();
+
+    /**********************************************************/
+    /* Frames a full destination holds keep their slabs from  */
+    /* being reused, move them out of the mostly free ones.   */
+    /**********************************************************/
+    if (starved || mFramePool.isFull())
+    {
+        for (int fd : mBlockedSockets)
+            mLanes[fd].compact(mFramePool);
+    }
+    return true;
+}
+
+/**
+ * Drains, reports and closes every connection, on the routing thread.
+ */
+void Switch::shutDown()
+{
+    if (!mHandedOff)
+        drain();
+
+    if (mFramePool.getSlabCount() > FRAME_POOL_SLABS)
+        fprintf(stdout, "  Server: frame pool grew to %lu slab(s)\n", mFramePool.getSlabCount());
 
-    fprintf(stdout, "  Server: %lu client(s) will be shut down\n", mSdQueue.size());
+    if (mDedup != nullptr && mDuplicates + mAnswered > 0)
+        fprintf(stdout, "  Server: %lu duplicate(s) dropped, %lu answered from the cache\n", mDuplicates, mAnswered);
+
+    if (mOrder != nullptr)
+        mOrder->report(stdout);
+
+    if (mHandedOff)
+        fprintf(stdout, "  Server: %lu client(s) handed off\n", mSdQueue.size());
+    else
+        fprintf(stdout, "  Server: %lu client(s) will be shut down\n", mSdQueue.size());
 
     /*************************************************************/
     /* Clean up all the sockets that are open                    */
@@ -238,43 +562,146 @@ void Switch::connectionHandler()
         mSdQueue.pop_front();
     }
 
-    mClients.clear();
+    for (auto& it : mConnections)
+    {
+        if (it.second->getMemberId() > -1)
+            mRegistry.remove(it.second->getMemberId());
+    }
+    mConnections.clear();
+    mRegistry.getDomain().reclaim();
     close(mListenSocket);
+    if (mUnixListenSocket > -1)
+    {
+        close(mUnixListenSocket);
+        if (!mHandedOff)
+            unlink(mUnixPath.c_str());
+    }
 
     mRunning.store(false);
+    signalStop(); // also when we stopped by ourselves
     printf("Server shut down\n");
 }
 
+/**
+ * Routes what members sent before the stop, writes out everything
+ * routed and stores the messages still pending, within the shutdown
+ * deadline.
+ */
+void Switch::drain()
+{
+    mDeadline = steadyMillis() + mShutdownDeadline;
+    mNow = steadyMillis();
+
+    std::deque<int> sockets;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        sockets = mSdQueue;
+    }
+    for (int fd : sockets)
+    {
+        if (steadyMillis() >= mDeadline)
+        {
+            fprintf(stderr, "  Server: shutdown deadline reached, input left unread\n");
+            break;
+        }
+        messageHandler(fd);
+    }
+
+    flushLanes();
+    flushCluster();
+
+    /**********************************************/
+    /* No transport blocks, wait for the full     */
+    /* ones to take the rest until the deadline.  */
+    /**********************************************/
+    std::vector<struct pollfd> pfds;
+    while (true)
+    {
+        pfds.clear();
+        for (int fd : mBlockedSockets)
+            pfds.push_back({fd, getConnection(fd).getWritableEvents(), 0});
+        for (int fd : sockets)
+        {
+            if (mCluster != nullptr && mCluster->hasOutput(fd))
+                pfds.push_back({fd, POLLOUT, 0});
+        }
+        if (pfds.empty())
+            break;
+
+        uint64_t now = steadyMillis();
+        if (now >= mDeadline)
+        {
+            fprintf(stderr, "  Server: shutdown deadline reached, output left unsent\n");
+            break;
+        }
+        if (poll(pfds.data(), pfds.size(), mDeadline - now) < 0 && errno != EINTR)
+        {
+            perror("  poll() failed");
+            break;
+        }
+
+        mNow = steadyMillis();
+        for (auto& pfd : pfds)
+        {
+            if (pfd.revents & POLLIN)
+                messageHandler(pfd.fd); // takes the doorbell
+        }
+        flushLanes();
+        flushCluster();
+    }
+
+    if (!mPendingMsgQueue.empty())
+    {
+        size_t stored = 0;
+        for (auto& it : mPendingMsgQueue)
+        {
+            if (mStore != nullptr && mStore->append(it.second.message))
+                stored++;
+        }
+        fprintf(stdout, "  Server: %lu pending message(s) stored, %lu dropped\n", stored,
+                mPendingMsgQueue.size() - stored);
+        mPendingMsgQueue.clear();
+    }
+}
+
 void Switch::messageHandler(int fd)
 {
-    char buffer[1024];
-    Message message;
+    const size_t batchSize = DECODE_BATCH_FRAMES * sizeof(isc_msg_t);
+    route_entry_t routes[DECODE_BATCH_FRAMES];
     int rc = 0;
 
+    if (mCluster != nullptr && mCluster->isPeer(fd))
+    {
+        peerHandler(fd);
+        return;
+    }
+
     /**********************************************/
-    /* Loop over until all data on this socket    */
-    /* is read.                                   */
+    /* Read one batch a round, so that a member   */
+    /* sending without pause does not starve the  */
+    /* others. The drain reads on until all data  */
+    /* on this socket is read.                    */
     /**********************************************/
     do
     {
         /**********************************************/
         /* Route unresolved queued messages first     */
         /**********************************************/
-        std::deque<Message> tempMsgQueue(mPendingMsgQueue);
-        while (!tempMsgQueue.empty())
-        {
-            mPendingMsgQueue.pop_front();
-            forwardMessage(tempMsgQueue.front());
-            tempMsgQueue.pop_front();
-        }
+        retryPending();
+        mFullLane = -1;
 
         /**********************************************/
-        /* Check for new messages                     */
+        /* Check for new messages, read in place into */
+        /* the frame pool behind the rest of a frame  */
+        /* cut short by the previous read.            */
         /**********************************************/
-        rc = receiveMessage(fd, buffer, sizeof(buffer), 10);
+        Connection& transport = getConnection(fd);
+        char* buffer = (char*) mFramePool.reserve(batchSize);
+        size_t carried = transport.copyPartial(buffer);
+        rc = transport.receive(buffer + carried, batchSize - carried);
         if (rc < 0)
         {
-            if (errno != EWOULDBLOCK)
+            if (errno != EWOULDBLOCK && errno != EAGAIN)
             {
                 perror("  receiveMessage() failed");
                 removeConnection(fd);
@@ -289,88 +716,891 @@ void Switch::messageHandler(int fd)
         }
 
         /**********************************************/
-        /* Data was received                          */
+        /* Data was received, fill the batch: a       */
+        /* transport may hand out less than it holds. */
         /**********************************************/
-        int len = rc;
+        int len = carried + rc;
+        bool drained = false;
+        while ((size_t) len < batchSize)
+        {
+            int more = transport.receive(buffer + len, batchSize - len);
+            if (more <= 0)
+            {
+                // a hang up or an error is seen first thing next round
+                drained = more < 0 && (errno == EWOULDBLOCK || errno == EAGAIN);
+                break;
+            }
+            len += more;
+        }
+
+        if (mIdleTimeout > 0 && (size_t) fd < mIdle.size())
+            mIdle[fd].lastActivity = mNow;
         // printf("  Server: %d bytes received\n", len);
 
-        if (len % message.getSize() != 0)
-            continue; // dump packet
+        int whole = len - len % sizeof(isc_msg_t);
+        transport.keepPartial(buffer + whole, len - whole);
+        if (whole == 0)
+            continue;
+        FrameRef batch = mFramePool.commit(whole);
 
         /**********************************************/
-        /* Fill in the message structure              */
+        /* Decode the routing fields of every frame   */
+        /* in the buffer at once.                     */
         /**********************************************/
-        char* ptr = &buffer[0];
-        for (int count = 0; count < (len / message.getSize()) && rc >= 0; count++)
+        int frames = whole / sizeof(isc_msg_t);
+        int valid = decodeFrames((const uint8_t*) buffer, frames, routes);
+        int lastSrcId = -1;
+
+        for (int count = 0; count < valid && rc >= 0; count++)
         {
-            memcpy(&message, ptr, message.getSize());
-            ptr += message.getSize();
+            const route_entry_t& route = routes[count];
+            const char* ptr = &buffer[route.index * sizeof(isc_msg_t)];
 
-            // printf("  Server: message(%d) from member(%d) to member(%d)\n", message.getMti(), message.getSrcId(),
-            // message.getDstId());
-            mClients.emplace(message.getSrcId(), fd);
+            // printf("  Server: message(%u) from member(%d) to member(%d)\n", route.mti, route.srcId, route.dstId);
+            if (mCluster != nullptr && route.mti == ISC_MTI_PEER_HELLO)
+            {
+                /**********************************************/
+                /* Another switch node dialed in, the rest    */
+                /* of the buffer belongs to the peer link.    */
+                /**********************************************/
+                Message hello(ptr);
+                ptr += hello.getSize();
+                mCluster->acceptPeer(fd, hello, mRegistry);
+                transport.keepPartial(ptr, 0); // still behind the frames, passed on with them
+                peerHandler(fd, ptr, len - (ptr - &buffer[0]));
+                return;
+            }
 
             /**********************************************/
-            /* Forward the data to the destination client */
+            /* A local member moves its traffic onto      */
+            /* shared-memory rings.                       */
             /**********************************************/
-            if (message.getDstId() > 0)
+            if (route.mti == ISC_MTI_SHM_ATTACH && !attachSharedMemory(fd, ptr))
             {
-                rc = forwardMessage(message);
+                removeConnection(fd);
+                return;
             }
-        }
 
-        if (rc < 0)
-        {
-            perror("send() failed");
-            removeConnection(fd);
-        }
-    } while (rc > 0);
-}
+            /**********************************************/
+            /* The member asks for the compact format.    */
+            /**********************************************/
+            if (route.mti == ISC_MTI_WIRE_V2 && !negotiateWireFormat(fd, ptr))
+            {
+                removeConnection(fd);
+                return;
+            }
 
-int Switch::forwardMessage(Message& message)
+            /**********************************************/
+            /* A connection carries one member, the first */
+            /* source seen on it.                         */
+            /**********************************************/
+            if (route.srcId != lastSrcId)
+            {
+                lastSrcId = route.srcId;
+                Connection& connection = getConnection(fd);
+                if (connection.getMemberId() < 0 && mRegistry.add(route.srcId, &connection))
+                {
+                    connection.setMemberId(route.srcId);
+                    mRetryPending = true;
+                    if (mCluster != nullptr)
+                        mCluster->memberUp(route.srcId);
+                    if (mStore != nullptr && mStore->hasPending(route.srcId))
+                        replayStored(route.srcId, fd);
+                }
+            }
+
+            /**********************************************/
+            /* Forward the data to the destination client */
+            /**********************************************/
+            if (route.dstId > 0)
+            {
+                FrameRef frame = batch.slice(route.index);
+                if (mDedup == nullptr || !isDuplicate(fd, *frame))
+                {
+                    if (mOrder != nullptr)
+                        mOrder->onIngress(*frame);
+                    rc = forwardMessage(frame);
+                }
+            }
+        }
+
+        if (rc < 0)
+        {
+            perror("send() failed");
+            removeConnection(fd);
+        }
+        else if (mDeadline == 0)
+        {
+            /**********************************************/
+            /* A destination holding too many frames      */
+            /* stops us reading until it took some.       */
+            /**********************************************/
+            if (mFullLane > -1)
+                mPaused[fd] = mFullLane;
+            else if (!drained)
+                readAgain(fd);
+        }
+    } while (rc > 0 && mDeadline != 0 && steadyMillis() < mDeadline && !mFramePool.isFull());
+}
+
+/**
+ * Reads a batch from a peer link, or until it would block while
+ * draining. Frames received from another node are delivered to local
+ * members only.
+ */
+void Switch::peerHandler(int fd, const char* data, size_t len)
 {
-    ipc_msg_t ipcMsg;
-    int sentSize = 0;
+    char buffer[PEER_BATCH_FRAMES * sizeof(isc_msg_t)];
+    auto deliver = [&](Message& message) { forwardMessage(FrameRef::borrow(message.getData()), true); };
 
-    auto it = mClients.find(message.getDstId());
-    if (it != mClients.end())
+    mFullLane = -1;
+    if (len > 0)
+        mCluster->onPeerData(fd, data, len, mRegistry, deliver);
+
+    while (true)
     {
-        sentSize = send(it->second, message.getData(), message.getSize(), 0);
+        int rc = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (rc > 0)
+        {
+            mCluster->onPeerData(fd, buffer, rc, mRegistry, deliver);
+            if (mDeadline != 0)
+                continue;
+            if (mFullLane > -1)
+                mPaused[fd] = mFullLane;
+            break; // one batch a round like members, the rest stays readable
+        }
 
-        // write message to Logger process's IPCQ
-        ipcMsg.type = 123;
-        memcpy(ipcMsg.text, &message, sizeof(message));
-        msgsnd(mMsgQueueId, &ipcMsg, sizeof(ipcMsg), 0);
+        if (rc < 0 && (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR))
+            break;
+
+        removeConnection(fd); // peer dropped the link
+        break;
+    }
+
+    if (mCluster != nullptr && mCluster->takeMembersUp())
+    {
+        mRetryPending = true;
+        retryPending();
+    }
+}
+
+int Switch::forwardMessage(const FrameRef& frame, bool fromPeer)
+{
+    if (mRequestTimeout > 0)
+    {
+        if (frame->trace[0] != 0)
+            matchReply(*frame);
+        else if (!fromPeer)
+            trackRequest(*frame); // the originator is ours
+    }
+
+    int sentSize = routeMessage(frame, fromPeer);
+    if (sentSize < 0)
+    {
+        queuePending(*frame, fromPeer); // unresolved message
+        sentSize = 0;
+    }
+    return sentSize;
+}
+
+/**
+ * Hands a frame to its destination: a local member, the node that owns
+ * it or the store. A member still taking its stored frames gets new ones
+ * through the store too, so that they keep their order.
+ * @param frame copied into the frame pool if it is borrowed and kept
+ * @return the size sent or queued, 0 if stored, -1 if unresolved
+ */
+int Switch::routeMessage(const FrameRef& frame, bool fromPeer)
+{
+    // the connection is not freed while the guard lives, even if its member leaves
+    EpochDomain::Guard guard(mRegistry.getDomain());
+    int dstId = memberId(frame->dst_id);
+    Connection* connection = mRegistry.find(dstId);
+    if (connection != nullptr && (mReplaying.empty() || mReplaying.count(dstId) == 0))
+    {
+        FrameRef kept = mFramePool.keep(frame); // the lane and the Logger share it
+        queueFrame(connection->getFd(), kept);  // written at the end of the round
+        logMessage(kept);
+        return sizeof(isc_msg_t);
+    }
+
+    int sentSize = 0;
+    Message message((const char*) frame.get()); // the cluster and the store keep their own copy
+    if (!fromPeer && mCluster != nullptr && mCluster->route(message))
+    {
+        sentSize = message.getSize(); // batched for the owning node
+    }
+    else if (mStore != nullptr && mStore->append(message))
+    {
+        // spilled to the destination's log until it registers
     }
     else
     {
-        mPendingMsgQueue.emplace_back(message); // unresolved message
+        sentSize = -1;
     }
 
     return sentSize;
 }
 
-void Switch::removeConnection(int fd)
+void Switch::queuePending(const isc_msg_t& frame, bool fromPeer)
 {
-    for (auto it = mSdQueue.begin(); it != mSdQueue.end(); it++)
+    uint64_t id = ++mPendingId;
+    TimerHandle timer = mPendingTimeout > 0 ? mTimers.add(mNow + mPendingTimeout, PendingTimer, id) : 0;
+    mPendingMsgQueue.emplace_hint(mPendingMsgQueue.end(), id, PendingMessage{Message((const char*) &frame), timer, fromPeer});
+}
+
+/**
+ * Routes the pending messages whose destination turned up. Only a member
+ * registering here or announced by a peer can resolve one.
+ */
+void Switch::retryPending()
+{
+    if (mPendingMsgQueue.empty() || !mRetryPending)
+        return;
+    mRetryPending = false;
+
+    auto it = mPendingMsgQueue.begin();
+    while (it != mPendingMsgQueue.end())
     {
-        if (*it == fd)
+        if (routeMessage(FrameRef::borrow(it->second.message.getData()), it->second.fromPeer) < 0)
         {
-            mSdQueue.erase(it);
-            break;
+            it++;
+            continue;
         }
+
+        mTimers.cancel(it->second.timer);
+        it = mPendingMsgQueue.erase(it);
     }
-    for (auto it : mClients)
+}
+
+/**
+ * Starts the reply timer of a request sent by a local member. A request
+ * already waiting with the same key keeps its timer.
+ */
+void Switch::trackRequest(const isc_msg_t& frame)
+{
+    RequestKey key{frame.mti.val, memberId(frame.src_id), memberId(frame.dst_id), getSequence(frame)};
+
+    auto result = mRequests.emplace(key, Outstanding{Message((const char*) &frame), 0});
+    if (result.second)
+        result.first->second.timer = mTimers.add(mNow + mRequestTimeout, RequestTimer, (uint64_t) &*result.first);
+}
+
+/**
+ * Stops the timer of the request a reply answers.
+ */
+void Switch::matchReply(const isc_msg_t& frame)
+{
+    RequestKey key{frame.mti.val - 10, memberId(frame.dst_id), memberId(frame.src_id), getSequence(frame)};
+
+    auto it = mRequests.find(key);
+    if (it != mRequests.end())
     {
-        if (it.second == fd)
+        mTimers.cancel(it->second.timer);
+        mRequests.erase(it);
+    }
+}
+
+/**
+ * Starts watching a socket for silence, once.
+ */
+void Switch::watchIdle(int fd)
+{
+    if ((size_t) fd >= mIdle.size())
+        mIdle.resize(fd + 1, IdleState{0, 0});
+    if (mIdle[fd].timer != 0 || (mCluster != nullptr && mCluster->isPeer(fd)))
+        return;
+
+    mIdle[fd].lastActivity = mNow;
+    mIdle[fd].timer = mTimers.add(mNow + mIdleTimeout, IdleTimer, fd);
+}
+
+/**
+ * Checks a frame from a local member against the ones it sent lately. A
+ * repeated request already answered gets the same reply again.
+ * @return true if the frame must not be forwarded
+ */
+bool Switch::isDuplicate(int fd, const isc_msg_t& frame)
+{
+    // a cached reply is written straight into the pool, kept only if it is sent
+    isc_msg_t* reply = (isc_msg_t*) mFramePool.reserve(sizeof(isc_msg_t));
+    switch (mDedup->check(frame, mNow, *reply))
+    {
+    case DedupCache::Duplicate:
+        mDuplicates++;
+        return true;
+    case DedupCache::Answered: {
+        mAnswered++;
+        FrameRef answer = mFramePool.commit(sizeof(isc_msg_t));
+        queueFrame(fd, answer);
+        logMessage(answer);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+void Switch::onTimer(int kind, uint64_t data)
+{
+    switch (kind)
+    {
+    case RequestTimer: {
+        /**********************************************/
+        /* Answer the originator in the responder's   */
+        /* place.                                     */
+        /**********************************************/
+        auto entry = (std::pair<const RequestKey, Outstanding>*) data;
+        Message reply = entry->second.request;
+        mRequests.erase(entry->first);
+
+        reply.setId(reply.getDstId(), reply.getSrcId());
+        reply.getMti() += 10;
+        reply.setReply(REPLY_TIMEOUT);
+        forwardMessage(FrameRef::borrow(reply.getData()));
+        break;
+    }
+    case PendingTimer:
+        mPendingMsgQueue.erase(data); // expired before its destination showed up
+        break;
+    case IdleTimer: {
+        int fd = (int) data;
+        IdleState& idle = mIdle[fd];
+        idle.timer = 0;
+        if (mNow - idle.lastActivity < (uint64_t) mIdleTimeout)
         {
-            mClients.erase(it.first);
-            fprintf(stdout, "  Server: client (ID: %d) shut down\n", it.first);
+            idle.timer = mTimers.add(idle.lastActivity + mIdleTimeout, IdleTimer, fd);
             break;
         }
+
+        fprintf(stdout, "  Server: connection (%d) silent for %d ms, dropped\n", fd, mIdleTimeout);
+        removeConnection(fd);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/**
+ * Queues a frame for a local member in the lane of its MTI class.
+ */
+void Switch::queueFrame(int fd, const FrameRef& frame)
+{
+    if ((size_t) fd >= mLanes.size())
+        mLanes.resize(fd + 1);
+
+    if (mLanes[fd].push(mScheduler.classify(frame->mti.val), frame))
+        mDirtySockets.push_back(fd);
+    if (mLanes[fd].size() >= LANE_MAX_FRAMES)
+        mFullLane = fd;
+}
+
+/**
+ * Reads fd next round whatever poll() says: a transport may hold input
+ * already taken from the descriptor, e.g. in a ring or decoded.
+ */
+void Switch::readAgain(int fd)
+{
+    if ((size_t) fd >= mReadAgain.size())
+        mReadAgain.resize(fd + 1, 0);
+
+    if (!mReadAgain[fd])
+    {
+        mReadAgain[fd] = 1;
+        mReadAgainCount++;
     }
+}
+
+bool Switch::takeReadAgain(int fd)
+{
+    if ((size_t) fd >= mReadAgain.size() || !mReadAgain[fd])
+        return false;
 
+    mReadAgain[fd] = 0;
+    mReadAgainCount--;
+    return true;
+}
+
+/**
+ * @return true while the destination fd filled is over half of
+ *         LANE_MAX_FRAMES, fd is read again once it is not
+ */
+bool Switch::isPaused(int fd)
+{
+    auto it = mPaused.find(fd);
+    if (it == mPaused.end())
+        return false;
+
+    int dst = it->second;
+    if ((size_t) dst < mLanes.size() && mLanes[dst].size() > LANE_MAX_FRAMES / 2)
+        return true;
+
+    mPaused.erase(it);
+    readAgain(fd);
+    return false;
+}
+
+/**
+ * Writes the frames queued this round, one send per destination. The
+ * destinations holding the most urgent frames go first.
+ */
+void Switch::flushLanes()
+{
+    if (mDirtySockets.empty() && mBlockedSockets.empty())
+        return;
+
+    // the destinations that did not take everything last time try again
+    std::vector<int> dirty;
+    dirty.swap(mDirtySockets);
+    dirty.insert(dirty.end(), mBlockedSockets.begin(), mBlockedSockets.end());
+    mBlockedSockets.clear();
+    std::stable_sort(dirty.begin(), dirty.end(),
+                     [&](int a, int b) { return mLanes[a].topLane() < mLanes[b].topLane(); });
+
+    for (int fd : dirty)
+    {
+        if (mLanes[fd].empty())
+            continue; // listed twice, or removed meanwhile
+
+        mFlushFrames.clear();
+        size_t offset = mLanes[fd].drain(mScheduler, mFlushFrames);
+
+        auto it = mConnections.find(fd);
+        if (it == mConnections.end())
+            continue;
+
+        /**********************************************/
+        /* Send the frames from where they were       */
+        /* received, one buffer per run of frames     */
+        /* that follow each other in a slab.          */
+        /**********************************************/
+        mFlushIov.clear();
+        for (size_t i = 0; i < mFlushFrames.size(); i++)
+        {
+            if (i > 0 && mFlushFrames[i - 1].precedes(mFlushFrames[i]))
+                mFlushIov.back().iov_len += sizeof(isc_msg_t);
+            else
+                mFlushIov.push_back(iovec{(void*) mFlushFrames[i].get(), sizeof(isc_msg_t)});
+        }
+        mFlushIov[0].iov_base = (char*) mFlushIov[0].iov_base + offset;
+        mFlushIov[0].iov_len -= offset;
+
+        size_t size = mFlushFrames.size() * sizeof(isc_msg_t) - offset;
+        size_t sent = 0;
+        size_t first = 0; // first buffer not sent in full
+        bool failed = false;
+        while (sent < size)
+        {
+            int rc = it->second->sendv(&mFlushIov[first], mFlushIov.size() - first);
+            if (rc <= 0)
+            {
+                failed = rc < 0 && errno != EWOULDBLOCK && errno != EAGAIN;
+                break; // failed, or full for now
+            }
+            sent += rc;
+
+            size_t left = rc;
+            while (left > 0 && left >= mFlushIov[first].iov_len)
+                left -= mFlushIov[first++].iov_len;
+            if (left > 0)
+            {
+                mFlushIov[first].iov_base = (char*) mFlushIov[first].iov_base + left;
+                mFlushIov[first].iov_len -= left;
+            }
+        }
+
+        size_t done = offset + sent; // bytes of mFlushFrames written
+        if (mOrder != nullptr)
+        {
+            for (size_t i = 0; i < done / sizeof(isc_msg_t); i++)
+                mOrder->onEgress(*mFlushFrames[i]);
+        }
+
+        if (failed)
+        {
+            perror("send() failed");
+            removeConnection(fd);
+            continue;
+        }
+
+        /**********************************************/
+        /* Keep what a full transport did not take    */
+        /* for the next round, unless it took nothing */
+        /* for too long.                              */
+        /**********************************************/
+        if (sent == size)
+        {
+            mLanes[fd].setStalledSince(0);
+            continue;
+        }
+        if (sent > 0 || mLanes[fd].getStalledSince() == 0)
+        {
+            mLanes[fd].setStalledSince(mNow);
+        }
+        else if (mNow - mLanes[fd].getStalledSince() > TIMEOUT)
+        {
+            fprintf(stderr, "  Server: connection (%d) took nothing for %d ms\n", fd, TIMEOUT);
+            removeConnection(fd);
+            continue;
+        }
+        mLanes[fd].keepUnsent(mFlushFrames, done / sizeof(isc_msg_t), done % sizeof(isc_msg_t));
+        mBlockedSockets.push_back(fd);
+    }
+    mFlushFrames.clear(); // lets the slabs go
+}
+
+void Switch::logMessage(const FrameRef& frame)
+{
+    if (mLog != nullptr)
+        mLog->post(frame);
+}
+
+/**
+ * Sends the messages stored while a member was offline, in order,
+ * before anything else it is routed.
+ */
+void Switch::replayStored(int id, int fd)
+{
+    Connection& connection = getConnection(fd);
+    int count = mStore->replay(id, [&](const uint8_t* data, size_t size, int) {
+        size_t sent = 0;
+        while (sent < size)
+        {
+            int rc = connection.send(data + sent, size - sent);
+            if (rc < 0 && (errno == EWOULDBLOCK || errno == EAGAIN))
+                break; // full, the rest stays stored
+            if (rc <= 0)
+                return -1;
+            sent += rc;
+        }
+
+        int frames = sent / sizeof(isc_msg_t);
+        for (int i = 0; i < frames; i++)
+        {
+            if (mOrder != nullptr)
+                mOrder->onEgress(*(const isc_msg_t*) (data + i * sizeof(isc_msg_t)));
+            logMessage(mFramePool.copy(data + i * sizeof(isc_msg_t)));
+        }
+
+        /**********************************************/
+        /* The lanes write the rest of a frame cut    */
+        /* short before anything else.                */
+        /**********************************************/
+        if (sent % sizeof(isc_msg_t) != 0)
+        {
+            std::vector<FrameRef> rest{mFramePool.copy(data + frames * sizeof(isc_msg_t))};
+            logMessage(rest[0]);
+            if ((size_t) fd >= mLanes.size())
+                mLanes.resize(fd + 1);
+            mLanes[fd].keepUnsent(rest, 0, sent % sizeof(isc_msg_t));
+            mBlockedSockets.push_back(fd);
+            frames++;
+        }
+        return frames;
+    });
+
+    if (count > 0)
+        mReplaying[id] += count;
+
+    // what is left goes out once the member made room, new frames queue behind it
+    if (mStore->hasPending(id))
+    {
+        mReplaying.emplace(id, 0);
+        return;
+    }
+
+    auto it = mReplaying.find(id);
+    if (it != mReplaying.end())
+    {
+        count = it->second;
+        mReplaying.erase(it);
+    }
+    if (count > 0)
+        fprintf(stdout, "  Server: %d stored message(s) replayed to client (ID: %d)\n", count, id);
+}
+
+/**
+ * Goes on with the replays a full transport cut short.
+ */
+void Switch::resumeReplays()
+{
+    auto it = mReplaying.begin();
+    while (it != mReplaying.end())
+    {
+        int id = (it++)->first; // replayStored() may erase it
+        Connection* connection = mRegistry.find(id);
+        if (connection == nullptr)
+            mReplaying.erase(id);
+        else if ((size_t) connection->getFd() >= mLanes.size() || !mLanes[connection->getFd()].isBlocked())
+            replayStored(id, connection->getFd()); // not behind the rest of a frame
+    }
+}
+
+/**
+ * Writes the frames batched for other switch nodes and drops the links
+ * that failed.
+ */
+void Switch::flushCluster()
+{
+    if (mCluster == nullptr)
+        return;
+
+    std::vector<int> broken;
+    mCluster->flush(broken);
+    for (int fd : broken)
+        removeConnection(fd);
+}
+
+/**
+ * Passes the listening socket, member sockets, routing table and pending
+ * messages to a successor process. Closing our copies afterwards does
+ * not close the connections.
+ * @return true if this process no longer owns the sockets
+ */
+bool Switch::handOff()
+{
+    int fd = mHandoff->acceptSuccessor();
+    if (fd < 0)
+        return false;
+
+    HandoffState state;
+    state.listenSocket = mListenSocket;
+    state.unixListenSocket = mUnixListenSocket;
+    flushLanes(); // what does not go out now is handed off with the socket
+    {
+        /**********************************************/
+        /* Stop accepting so that no connection is    */
+        /* left behind in this process.               */
+        /**********************************************/
+        std::lock_guard<std::mutex> lock(mMutex);
+        mAccepting = false;
+        for (int sd : mSdQueue)
+        {
+            if (mCluster != nullptr && mCluster->isPeer(sd))
+                continue; // peer links are re-established by the successor
+
+            auto connection = mConnections.find(sd);
+            if (connection != mConnections.end() && connection->second->isSharedMemory())
+                continue; // rings are not handed off, such members attach again
+
+            int id = connection != mConnections.end() ? connection->second->getMemberId() : -1;
+            wire_state_t wireState;
+            std::string input;
+            if (connection != mConnections.end())
+            {
+                connection->second->saveWireState(wireState);
+                connection->second->saveInput(input);
+            }
+            else
+            {
+                wireReset(wireState, 1);
+            }
+
+            /**********************************************/
+            /* The frames left in the lanes, kept there   */
+            /* in case the successor fails.               */
+            /**********************************************/
+            std::string unsent;
+            size_t offset = 0;
+            if ((size_t) sd < mLanes.size() && !mLanes[sd].empty())
+            {
+                mFlushFrames.clear();
+                offset = mLanes[sd].drain(mScheduler, mFlushFrames);
+                for (auto& frame : mFlushFrames)
+                    unsent.append((const char*) frame.get(), sizeof(isc_msg_t));
+                mLanes[sd].keepUnsent(mFlushFrames, 0, offset);
+                mFlushFrames.clear();
+            }
+
+            state.sockets.push_back(sd);
+            state.memberIds.push_back(id);
+            state.wireStates.push_back(wireState);
+            state.inputs.push_back(std::move(input));
+            state.unsent.push_back(std::move(unsent));
+            state.unsentOffsets.push_back(offset);
+        }
+    }
+    for (auto& it : mPendingMsgQueue)
+        state.pending.push_back(it.second.message);
+
+    if (mHandoff->send(fd, state) != 0)
+    {
+        fprintf(stderr, "  Server: handoff failed, keep routing\n");
+        close(fd);
+        mAccepting = true;
+        return false;
+    }
     close(fd);
+
+    fprintf(stdout, "  Server: %lu connection(s) handed off to successor\n", state.sockets.size());
+    mPendingMsgQueue.clear();
+    mHandedOff = true;
+    mRunning = false;
+    return true;
+}
+
+void Switch::addConnection(std::unique_ptr<Connection> connection)
+{
+    int fd = connection->getFd();
+    mConnections[fd] = std::move(connection);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSdQueue.emplace_back(fd);
+    wakeRouting();
+}
+
+size_t Switch::getMaxLaneSize() const
+{
+    size_t most = 0;
+    for (const auto& lanes : mLanes)
+        most = std::max(most, lanes.size());
+    return most;
+}
+
+/**
+ * Transport of a polled socket, a plain socket unless the member
+ * attached shared memory.
+ */
+Connection& Switch::getConnection(int fd)
+{
+    auto it = mConnections.find(fd);
+    if (it == mConnections.end())
+        it = mConnections.emplace(fd, make_unique_cpp11<SocketConnection>(fd)).first;
+    return *it->second;
+}
+
+/**
+ * Maps the memfd a Unix-domain member passed with frame and acknowledges
+ * it by echoing the frame, after which the member uses the rings.
+ * @return false if the member did not pass a valid region
+ */
+bool Switch::attachSharedMemory(int fd, const char* frame)
+{
+    int memFd = getConnection(fd).takeAttachedFd();
+    shm_region_t* region = memFd > -1 ? ShmConnection::map(memFd) : nullptr;
+    if (memFd > -1)
+        close(memFd);
+
+    if (region == nullptr)
+    {
+        fprintf(stderr, "  Server: shared memory attach failed on connection (%d)\n", fd);
+        return false;
+    }
+
+    Message ack(frame);
+    ack.setReply(true);
+    if (send(fd, ack.getData(), ack.getSize(), MSG_NOSIGNAL) != ack.getSize())
+    {
+        munmap(region, sizeof(shm_region_t));
+        return false;
+    }
+
+    /**********************************************/
+    /* Readers may hold the socket transport of a */
+    /* registered member, swap and retire it.     */
+    /**********************************************/
+    auto connection = make_unique_cpp11<ShmConnection>(fd, region);
+    std::unique_ptr<Connection>& previous = mConnections[fd];
+    int id = previous->getMemberId();
+    if (id > -1)
+    {
+        mRegistry.remove(id);
+        mRegistry.add(id, connection.get());
+        connection->setMemberId(id);
+    }
+    retireConnection(std::move(previous), -1);
+    previous = std::move(connection);
+    return true;
+}
+
+/**
+ * Acknowledges a member's request for the v2 wire format by echoing its
+ * frame, still in v1, and switches the connection over.
+ * @return false if the transport cannot carry v2
+ */
+bool Switch::negotiateWireFormat(int fd, const char* frame)
+{
+    Connection& connection = getConnection(fd);
+    if (connection.isSharedMemory())
+    {
+        fprintf(stderr, "  Server: wire format v2 refused on shared memory connection (%d)\n", fd);
+        return false;
+    }
+
+    Message ack(frame);
+    ack.setReply(true);
+    if (connection.send(ack.getData(), ack.getSize()) != ack.getSize())
+        return false;
+
+    return connection.setWireVersion(2);
+}
+
+void Switch::removeConnection(int fd)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto it = mSdQueue.begin(); it != mSdQueue.end(); it++)
+        {
+            if (*it == fd)
+            {
+                mSdQueue.erase(it);
+                break;
+            }
+        }
+    }
+    takeReadAgain(fd);
+    mPaused.erase(fd);
+
+    if (mCluster != nullptr && mCluster->isPeer(fd))
+    {
+        mCluster->removePeer(fd);
+        mConnections.erase(fd); // never registered, no reader holds it
+        close(fd);
+        return;
+    }
+
+    auto it = mConnections.find(fd);
+    if (it == mConnections.end())
+    {
+        close(fd);
+        return;
+    }
+
+    if ((size_t) fd < mLanes.size())
+        mLanes[fd].clear(); // nobody left to write them to
+    if ((size_t) fd < mIdle.size())
+    {
+        mTimers.cancel(mIdle[fd].timer);
+        mIdle[fd] = IdleState{0, 0};
+    }
+
+    int id = it->second->getMemberId();
+    if (id > -1)
+    {
+        mRegistry.remove(id);
+        fprintf(stdout, "  Server: client (ID: %d) shut down\n", id);
+        if (mCluster != nullptr)
+            mCluster->memberDown(id);
+    }
+
+    retireConnection(std::move(it->second), fd);
+    mConnections.erase(it);
+}
+
+/**
+ * Frees a transport once no sender can still be using it. The socket is
+ * closed with it, so its number is not reused under such a sender.
+ * @param fd socket to close along, or -1 to keep it open
+ */
+void Switch::retireConnection(std::unique_ptr<Connection> connection, int fd)
+{
+    Connection* released = connection.release();
+    mRegistry.getDomain().retire([released, fd]() {
+        delete released;
+        if (fd > -1)
+            close(fd);
+    });
 }
 
 /**
@@ -388,21 +1618,45 @@ void Logger::ipcQueueHandler()
 {
     std::lock_guard<std::mutex> lock(mMutex);
 
-    Message message;
     ipc_msg_t ipcMsg;
+    LogBatch output(stdout);
+    bool stopping = false;
 
-    while (mRunning)
+    while (mRunning && !stopping)
     {
-        // receive message
-        msgrcv(mMsgQueueId, &ipcMsg, sizeof(ipcMsg), 0, 0);
-        if (ipcMsg.type == 123)
-        {
-            memcpy(&message, ipcMsg.text, sizeof(message));
-            message.printData(stdout); // save to file
-        }
-        else
+        /**********************************************/
+        /* Wait for one record, then take whatever    */
+        /* else is queued and print it all at once.   */
+        /**********************************************/
+        int flags = 0;
+        for (int count = 0; count < LOG_BATCH_RECORDS && !stopping; count++)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            if (msgrcv(mMsgQueueId, &ipcMsg, sizeof(ipcMsg.text), 0, flags) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                stopping = errno != ENOMSG; // queue removed
+                break;
+            }
+            flags = IPC_NOWAIT;
+
+            if (ipcMsg.type == LOG_MSG_TYPE)
+            {
+                journal_record_t* record = (journal_record_t*) ipcMsg.text;
+                output.add(record->frame); // save to file
+
+                if (mJournal != nullptr)
+                    fwrite(record, sizeof(*record), 1, mJournal);
+            }
+            else if (ipcMsg.type == LOG_QUIT_TYPE)
+            {
+                stopping = true; // everything sent before it is printed
+            }
         }
+        output.flush();
     }
+
+    fflush(stdout);
+    mRunning = false;
+    signalStop();
 }
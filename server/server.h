@@ -10,6 +10,7 @@
 #include <atomic>
 #include <vector>
 #include <deque>
+#include <map>
 #include <unordered_map>
 #include <cstdlib>
 #include <cstdio>
@@ -19,9 +20,24 @@
 #include <sys/select.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include "isc_msg.h"
+#include "cluster.h"
+#include "msgstore.h"
+#include "handoff.h"
+#include "logger.h"
+#include "connection.h"
+#include "registry.h"
+#include "lanes.h"
+#include "timerwheel.h"
+#include "dedup.h"
+#include "framepool.h"
+#include "ordering.h"
+
+#define TIMER_POLL_TIMEOUT 50 /* milliseconds, poll() timeout while timers are pending */
+#define SHUTDOWN_DEADLINE 2000 /* milliseconds, default time given to drain on shutdown */
 
 #define LOG_ERROR(err)                                                                                                 \
     fprintf(stderr, "ERROR:\tfrom %s,\tline (%d),\tfunction %s failed --> %s\n", __FILE__, __LINE__, __FUNCTION__, err)
@@ -32,20 +48,26 @@ class ServerBase
 {
   public:
     ServerBase(int port = BASE_PORT, int maxClients = 999)
-        : mPort(port), mMaxConns(maxClients), mListenSocket(-1), mRunning(true)
+        : mPort(port), mListenSocket(-1), mMaxConns(maxClients), mStopFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+          mRunning(true)
     {
-        key_t msgKey = ftok("iscChallenge.isc", 'B');
-        mMsgQueueId = msgget(msgKey, 0666 | IPC_CREAT);
     }
 
     virtual ~ServerBase()
     {
+        if (mStopFd > -1)
+            close(mStopFd);
     }
 
     virtual void run() = 0;
+
+    /**
+     * Stops the server, every loop waiting in it wakes up at once.
+     */
     void deinit()
     {
         mRunning = false;
+        signalStop();
     }
     int getPort() const
     {
@@ -56,14 +78,29 @@ class ServerBase
         return mRunning.load();
     }
 
+    /**
+     * An eventfd that turns readable, for good, once the server stops.
+     */
+    int getStopFd() const
+    {
+        return mStopFd;
+    }
+
   protected:
     virtual int init() = 0;
     int receiveMessage(int fd, char* buffer, size_t size, int timeout);
 
+    void signalStop()
+    {
+        uint64_t one = 1;
+        if (write(mStopFd, &one, sizeof(one)) < 0)
+            perror("  eventfd write() failed");
+    }
+
     int mPort;
     int mListenSocket;
     int mMaxConns;
-    int mMsgQueueId;
+    int mStopFd; // never read, so that it wakes every poll() at once
 
     std::mutex mMutex{};
     std::atomic_bool mRunning; // used to be able to terminate background threads
@@ -72,65 +109,333 @@ class ServerBase
 class Switch : public ServerBase
 {
   public:
+    /**
+     * @param port TCP port members connect to, -1 for none, see addConnection()
+     */
     Switch(int port = BASE_PORT, int maxClients = 999) : ServerBase(port, maxClients)
     {
         if (init() != 0)
             throw std::runtime_error("Switch::init() failed");
     }
+
+    /**
+     * Takes over the sockets and routing table of a predecessor process.
+     */
+    Switch(HandoffState& state, int maxClients = 999);
+
     ~Switch() final
     {
-        mRunning = false;
+        deinit(); // the connection thread drains before it returns
+
+        if (mCluster != nullptr)
+            mCluster->stop();
 
         if (mAcceptHandler != nullptr)
             mAcceptHandler->join();
 
         if (mConnectionHandler != nullptr)
             mConnectionHandler->join();
+        else
+            shutDown(); // driven by step(), on this thread
 
         if (mMsgQueueHandler != nullptr)
             mMsgQueueHandler->join();
+
+        close(mWakeFd);
     }
 
     void run() override;
 
+    /**
+     * Runs one round of the routing loop on the calling thread, in place
+     * of run(): waits up to timeoutMs for input (-1 for the usual poll
+     * timeout), routes it and writes out what was routed. The destructor
+     * then drains and closes the connections.
+     * @return false once the switch has stopped
+     */
+    bool step(int timeoutMs);
+
+    /**
+     * Serves a member over a transport of the caller's making, whose
+     * descriptor polls readable when it has input. From the routing
+     * thread only, i.e. with step().
+     */
+    void addConnection(std::unique_ptr<Connection> connection);
+
+    /**
+     * Joins a cluster of switch nodes. Must be called before run().
+     */
+    void enableCluster(int nodeId, const std::vector<PeerAddress>& peers);
+
+    /**
+     * Spills messages for offline members to per-destination logs under
+     * dir instead of the in-memory pending queue. Must be called before run().
+     * @return 0 on success
+     */
+    int enableStore(const std::string& dir, int ttlSeconds);
+
+    /**
+     * Lets a successor process take over from this one via a Unix-domain
+     * socket at path. Must be called before run().
+     * @return 0 on success
+     */
+    int enableHandoff(const std::string& path);
+
+    /**
+     * Also accepts members on a Unix-domain stream socket at path, over
+     * which they may attach shared-memory rings. Must be called before run().
+     * @return 0 on success
+     */
+    int enableUnixSocket(const std::string& path);
+
+    /**
+     * Splits every destination's output into priority classes by MTI, see
+     * LaneScheduler for the formats. weights may be empty for strict
+     * priority. Must be called before run().
+     * @return 0 on success
+     */
+    int enableLanes(const std::string& classes, const std::string& weights);
+
+    /**
+     * Sets the timers of the routing loop in milliseconds, 0 disables one:
+     * how long a request waits for its reply before the switch answers it
+     * with a REPLY_TIMEOUT reply, how long an unresolved message stays
+     * pending and how long a member may stay silent before it is dropped.
+     * Any frame resets the silence, e.g. one with dst_id 0 as a heartbeat.
+     * Must be called before run().
+     */
+    void setTimeouts(int requestMs, int pendingMs, int idleMs);
+
+    /**
+     * Drops frames a member sends again within windowMs, or answers a
+     * repeated request with the reply already routed for it. Must be
+     * called before run().
+     */
+    void enableDedup(int windowMs);
+
+    /**
+     * Checks that the requests of every (src, dst) pair leave in the
+     * order they came in, by the sequences members stamp. Counters are
+     * reported on shutdown. Must be called before run().
+     */
+    void enableOrderCheck();
+
+    /**
+     * Bounds the drain on shutdown: reading what members already sent,
+     * writing out what was routed and storing what is still pending.
+     * Input left past the deadline is lost. Must be called before run().
+     */
+    void setShutdownDeadline(int deadlineMs)
+    {
+        mShutdownDeadline = deadlineMs;
+    }
+
+    bool isHandedOff() const
+    {
+        return mHandedOff.load();
+    }
+
+    /**
+     * Frame pool slabs allocated now. From the routing thread only.
+     */
+    size_t getSlabCount() const
+    {
+        return mFramePool.getSlabCount();
+    }
+
+    /**
+     * @return the most frames held for one destination now, from the
+     *         routing thread only
+     */
+    size_t getMaxLaneSize() const;
+
+    /**
+     * Routed messages are posted to channel. Must be called before run().
+     */
+    void setLogChannel(std::unique_ptr<LogChannel> channel)
+    {
+        mLog = std::move(channel);
+    }
+
   private:
+    enum TimerKind
+    {
+        RequestTimer, // data = outstanding request
+        PendingTimer, // data = pending message id
+        IdleTimer     // data = socket
+    };
+
+    // a request waiting for its reply, matched on everything the reply echoes
+    struct RequestKey
+    {
+        uint32_t mti;
+        int srcId;
+        int dstId;
+        uint64_t trace;
+
+        bool operator==(const RequestKey& other) const
+        {
+            return mti == other.mti && srcId == other.srcId && dstId == other.dstId && trace == other.trace;
+        }
+    };
+
+    struct RequestKeyHash
+    {
+        size_t operator()(const RequestKey& key) const
+        {
+            return (key.trace * 0x9E3779B97F4A7C15ull) ^ ((uint64_t) key.srcId << 40) ^ ((uint64_t) key.dstId << 16) ^
+                   key.mti;
+        }
+    };
+
+    struct Outstanding
+    {
+        Message request;
+        TimerHandle timer;
+    };
+
+    struct PendingMessage
+    {
+        Message message;
+        TimerHandle timer;
+        bool fromPeer; // routed here by another node, never sent back
+    };
+
+    struct IdleState
+    {
+        uint64_t lastActivity;
+        TimerHandle timer; // 0 when the socket is not watched
+    };
+
     int init() override;
-    int forwardMessage(Message& message);
+    int forwardMessage(const FrameRef& frame, bool fromPeer = false);
+    int routeMessage(const FrameRef& frame, bool fromPeer);
+    void queuePending(const isc_msg_t& frame, bool fromPeer = false);
+    void retryPending();
+    void trackRequest(const isc_msg_t& frame);
+    void matchReply(const isc_msg_t& frame);
+    void watchIdle(int fd);
+    bool isDuplicate(int fd, const isc_msg_t& frame);
+    void onTimer(int kind, uint64_t data);
+    void logMessage(const FrameRef& frame);
+    void replayStored(int id, int fd);
+    void resumeReplays();
+    bool handOff();
+    Connection& getConnection(int fd);
+    bool attachSharedMemory(int fd, const char* frame);
+    bool negotiateWireFormat(int fd, const char* frame);
+    void retireConnection(std::unique_ptr<Connection> connection, int fd);
+    void queueFrame(int fd, const FrameRef& frame);
+    void readAgain(int fd);
+    bool takeReadAgain(int fd);
+    bool isPaused(int fd);
+    void flushLanes();
+    void flushCluster();
+    void drain();
+    void wakeRouting();
 
     void acceptHandler();
     void connectionHandler();
+    void shutDown();
     void messageHandler(int fd);
+    void peerHandler(int fd, const char* data = nullptr, size_t len = 0);
     void removeConnection(int fd);
 
     std::deque<int> mSdQueue{};
-    std::deque<Message> mPendingMsgQueue{};
+    int mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC); // mSdQueue changed
+    std::map<uint64_t, PendingMessage> mPendingMsgQueue{}; // id --> message, oldest first
+    uint64_t mPendingId = 0;
+    bool mRetryPending = true; // a member registered since the last retry
+
+    FramePool mFramePool{}; // outlives everything below that holds frames
+
+    MemberRegistry mRegistry{}; // id --> transport, read without locks
+    std::unordered_map<int, std::unique_ptr<Connection>> mConnections{}; // socket --> transport
+    std::vector<OutputLanes> mLanes{}; // indexed by socket, frames not written yet
+    std::vector<int> mDirtySockets{};  // sockets with queued frames
+    std::vector<int> mBlockedSockets{}; // sockets that did not take all of them
+    std::vector<char> mReadAgain{};     // indexed by socket, input may be left after its batch
+    size_t mReadAgainCount = 0;
+    std::unordered_map<int, int> mPaused{}; // reader --> destination whose lanes it filled
+    int mFullLane = -1;                     // destination over LANE_MAX_FRAMES this batch, -1 if none
+    std::vector<FrameRef> mFlushFrames{};
+    std::vector<struct iovec> mFlushIov{};
+    LaneScheduler mScheduler{};
+
+    TimerWheel mTimers{steadyMillis()};
+    uint64_t mNow = steadyMillis(); // read once per loop round
+    std::chrono::steady_clock::time_point mLastSweep = std::chrono::steady_clock::now(); // of the store
+    int mRequestTimeout = 0;
+    int mPendingTimeout = 0;
+    int mIdleTimeout = 0;
+    std::unordered_map<RequestKey, Outstanding, RequestKeyHash> mRequests{};
+    std::vector<IdleState> mIdle{}; // indexed by socket
+
+    int mShutdownDeadline = SHUTDOWN_DEADLINE;
+    uint64_t mDeadline = 0; // steadyMillis() the drain ends, 0 while routing
 
-    std::unordered_map<int, int> mClients{}; // id --> socket
+    std::unique_ptr<DedupCache> mDedup; // null when duplicates are forwarded
+    unsigned long mDuplicates = 0;
+    unsigned long mAnswered = 0;
+    std::unique_ptr<OrderMonitor> mOrder; // null when ordering is not checked
     pid_t mChildId;
 
+    std::unique_ptr<Cluster> mCluster; // null when running standalone
+    std::unique_ptr<MessageStore> mStore; // null when pending messages stay in memory
+    std::map<int, int> mReplaying{};      // member --> stored frames it took so far, while its transport is full
+    std::unique_ptr<Handoff> mHandoff;    // null when hot restart is disabled
+    std::unique_ptr<LogChannel> mLog;     // null when logging is disabled
+
+    int mUnixListenSocket = -1; // -1 when members connect over TCP only
+    std::string mUnixPath;
+
+    std::atomic_bool mAccepting{true};
+    std::atomic_bool mHandedOff{false};
+
     std::unique_ptr<std::thread> mAcceptHandler;
     std::unique_ptr<std::thread> mConnectionHandler;
     std::unique_ptr<std::thread> mMsgQueueHandler;
 };
 
+/**
+ * Consumer side of a SysV message queue, run either in a forked child of
+ * the Switch or as a standalone logger daemon.
+ */
 class Logger : public ServerBase
 {
   public:
-    Logger()
+    /**
+     * @param ownsQueue remove the queue on destruction (daemon mode)
+     * @param journal binary journal to append records to, closed on
+     *                destruction (optional)
+     */
+    Logger(int queueId, bool ownsQueue, FILE* journal = nullptr)
+        : mMsgQueueId(queueId), mOwnsQueue(ownsQueue), mJournal(journal)
     {
         mFilePtr = fopen(FILENAME, "w");
     }
     ~Logger() override
     {
-        mRunning = false;
-        msgctl(mMsgQueueId, IPC_RMID, nullptr); // destroy the message queue
+        /**************************************************/
+        /* The daemon prints what is queued before it     */
+        /* removes the queue: a QUIT record queued behind */
+        /* the rest ends the handler.                     */
+        /**************************************************/
+        ipc_msg_t ipcMsg;
+        ipcMsg.type = LOG_QUIT_TYPE;
+        if (mOwnsQueue && msgsnd(mMsgQueueId, &ipcMsg, sizeof(ipcMsg.text), IPC_NOWAIT) < 0)
+            msgctl(mMsgQueueId, IPC_RMID, nullptr); // full, the backlog is lost
 
         printf("~Logger() called\n");
-        
+
         if (mMsgQueueHandler != nullptr)
             mMsgQueueHandler->join();
+        if (mOwnsQueue)
+            msgctl(mMsgQueueId, IPC_RMID, nullptr); // destroy the message queue
 
         fclose(mFilePtr);
+        if (mJournal != nullptr)
+            fclose(mJournal);
     }
 
     int init() override
@@ -142,6 +447,9 @@ class Logger : public ServerBase
   private:
     void ipcQueueHandler();
 
+    int mMsgQueueId;
+    bool mOwnsQueue;
+    FILE* mJournal;
     FILE* mFilePtr = nullptr; // used to save messages to a file
     std::unique_ptr<std::thread> mMsgQueueHandler;
 };
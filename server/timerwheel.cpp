@@ -0,0 +1,173 @@
+#include "timerwheel.h"
+
+#define WHEEL_NIL UINT32_MAX
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_SPAN ((uint64_t) 1 << (WHEEL_LEVELS * WHEEL_SLOT_BITS))
+
+TimerWheel::TimerWheel(uint64_t now) : mCurrent(now)
+{
+    for (auto& head : mSlots)
+        head = WHEEL_NIL;
+    for (auto& bits : mOccupied)
+        bits = 0;
+}
+
+TimerHandle TimerWheel::add(uint64_t expires, int kind, uint64_t data)
+{
+    uint32_t index;
+    if (!mFree.empty())
+    {
+        index = mFree.back();
+        mFree.pop_back();
+    }
+    else
+    {
+        index = mNodes.size();
+        mNodes.push_back(TimerNode{0, 0, 0, WHEEL_NIL, WHEEL_NIL, 0, -1});
+    }
+
+    TimerNode& node = mNodes[index];
+    node.expires = expires > mCurrent ? expires : mCurrent + 1;
+    node.data = data;
+    node.kind = kind;
+    node.generation++;
+    link(index);
+    mCount++;
+    return ((uint64_t) node.generation << 32) | index;
+}
+
+bool TimerWheel::cancel(TimerHandle handle)
+{
+    uint32_t index = handle & 0xffffffff;
+    if (index >= mNodes.size() || mNodes[index].generation != (handle >> 32) || mNodes[index].slot < 0)
+        return false;
+
+    unlink(index);
+    mNodes[index].generation++;
+    mFree.push_back(index);
+    mCount--;
+    return true;
+}
+
+size_t TimerWheel::advance(uint64_t now, const Callback& callback)
+{
+    size_t fired = 0;
+    while (mCurrent < now)
+    {
+        if (mCount == 0)
+        {
+            mCurrent = now; // nothing to step through
+            break;
+        }
+        mCurrent = nextTick(now);
+
+        /**********************************************/
+        /* Each time a level wraps, the next slot of  */
+        /* the level above is spread over this one.   */
+        /**********************************************/
+        for (int level = 1; level < WHEEL_LEVELS; level++)
+        {
+            if ((mCurrent >> ((level - 1) * WHEEL_SLOT_BITS) & WHEEL_MASK) != 0)
+                break;
+            cascade(level);
+        }
+
+        uint32_t& head = mSlots[mCurrent & WHEEL_MASK];
+        while (head != WHEEL_NIL)
+        {
+            uint32_t index = head;
+            unlink(index);
+
+            TimerNode& node = mNodes[index];
+            if (node.expires > mCurrent)
+            {
+                link(index); // beyond the span of the wheel, another lap
+                continue;
+            }
+
+            // free the node first, the callback may add timers
+            int kind = node.kind;
+            uint64_t data = node.data;
+            node.generation++;
+            mFree.push_back(index);
+            mCount--;
+
+            callback(kind, data);
+            fired++;
+        }
+    }
+    return fired;
+}
+
+void TimerWheel::link(uint32_t index)
+{
+    TimerNode& node = mNodes[index];
+    uint64_t expires = node.expires > mCurrent ? node.expires : mCurrent;
+    uint64_t delta = expires - mCurrent;
+    if (delta >= WHEEL_SPAN)
+    {
+        expires = mCurrent + WHEEL_SPAN - 1; // parked in the last slot, linked again from there
+        delta = WHEEL_SPAN - 1;
+    }
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= ((uint64_t) 1 << ((level + 1) * WHEEL_SLOT_BITS)))
+        level++;
+
+    node.slot = level * WHEEL_SLOTS + (expires >> (level * WHEEL_SLOT_BITS) & WHEEL_MASK);
+    node.prev = WHEEL_NIL;
+    node.next = mSlots[node.slot];
+    if (node.next != WHEEL_NIL)
+        mNodes[node.next].prev = index;
+    mSlots[node.slot] = index;
+    if (level == 0)
+        mOccupied[node.slot / 64] |= (uint64_t) 1 << (node.slot % 64);
+}
+
+void TimerWheel::unlink(uint32_t index)
+{
+    TimerNode& node = mNodes[index];
+    if (node.prev != WHEEL_NIL)
+        mNodes[node.prev].next = node.next;
+    else
+        mSlots[node.slot] = node.next;
+    if (node.next != WHEEL_NIL)
+        mNodes[node.next].prev = node.prev;
+    if (node.slot < WHEEL_SLOTS && mSlots[node.slot] == WHEEL_NIL)
+        mOccupied[node.slot / 64] &= ~((uint64_t) 1 << (node.slot % 64));
+    node.slot = -1;
+}
+
+void TimerWheel::cascade(int level)
+{
+    int slot = level * WHEEL_SLOTS + (mCurrent >> (level * WHEEL_SLOT_BITS) & WHEEL_MASK);
+    uint32_t index = mSlots[slot];
+    mSlots[slot] = WHEEL_NIL;
+
+    while (index != WHEEL_NIL)
+    {
+        uint32_t next = mNodes[index].next;
+        link(index);
+        index = next;
+    }
+}
+
+/**
+ * @return the next tick with something to do: a level 0 slot holding
+ * timers, the end of the lap (a cascade) or now, whichever comes first
+ */
+uint64_t TimerWheel::nextTick(uint64_t now) const
+{
+    uint64_t lap = mCurrent & ~(uint64_t) WHEEL_MASK;
+    uint64_t next = lap + WHEEL_SLOTS;
+    for (uint32_t slot = (mCurrent & WHEEL_MASK) + 1; slot < WHEEL_SLOTS; slot = (slot | 63) + 1)
+    {
+        uint64_t bits = mOccupied[slot / 64] >> (slot % 64);
+        if (bits != 0)
+        {
+            next = lap + slot + __builtin_ctzll(bits);
+            break;
+        }
+    }
+    return next < now ? next : now;
+}
@@ -0,0 +1,85 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+
+using TimerHandle = uint64_t; // 0 is never a valid timer
+
+inline uint64_t steadyMillis()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Hierarchical timing wheel with a 1 ms tick.
+ *
+ * Level 0 has one slot per tick, every level above one slot per turn of
+ * the level below, so four levels of 256 slots reach about 49 days.
+ * Timers move down a level when the wheel reaches their slot. Adding and
+ * cancelling a timer is O(1). Nothing here reads the clock; the owner
+ * passes the time in, once per loop round.
+ */
+class TimerWheel
+{
+  public:
+    using Callback = std::function<void(int kind, uint64_t data)>;
+
+    explicit TimerWheel(uint64_t now);
+
+    /**
+     * Schedules callback(kind, data) at expires (milliseconds, same clock
+     * as advance()). A time already past fires on the next tick.
+     */
+    TimerHandle add(uint64_t expires, int kind, uint64_t data);
+
+    /**
+     * @return false if the timer already fired or was cancelled
+     */
+    bool cancel(TimerHandle handle);
+
+    /**
+     * Fires every timer due by now, in order. Callbacks may add and
+     * cancel timers.
+     * @return the number of timers fired
+     */
+    size_t advance(uint64_t now, const Callback& callback);
+
+    size_t size() const
+    {
+        return mCount;
+    }
+
+  private:
+    struct TimerNode
+    {
+        uint64_t expires;
+        uint64_t data;
+        uint32_t generation; // odd while scheduled
+        uint32_t prev;
+        uint32_t next;
+        int kind;
+        int slot; // -1 when free
+    };
+
+    void link(uint32_t index);
+    void unlink(uint32_t index);
+    void cascade(int level);
+    uint64_t nextTick(uint64_t now) const;
+
+    std::vector<TimerNode> mNodes{};
+    std::vector<uint32_t> mFree{};
+    uint32_t mSlots[WHEEL_LEVELS * WHEEL_SLOTS]; // head of each slot's list
+    uint64_t mOccupied[WHEEL_SLOTS / 64];        // level 0 slots holding timers
+    uint64_t mCurrent;                           // last tick processed
+    size_t mCount = 0;
+};
+
+#endif // TIMERWHEEL_H